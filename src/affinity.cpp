@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sched.h>
+#include <pthread.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+
+#include <stdexcept>
+#include <new>
+#include <map>
+
+#include "affinity.hpp"
+#include "valueparser.hpp"
+
+
+void cAffinity::set (const char* cpus, mode_t mode)
+{
+    cpu_set_t allowed;
+    CPU_ZERO (&allowed);
+    if (sched_getaffinity (0, sizeof (allowed), &allowed))
+        throw std::invalid_argument ("CPU affinity not supported");
+
+    std::vector<int> list;
+    if (cpus)
+    {
+        for (const auto& range : cValueParser::rangeList (cpus))
+        {
+            for (auto n = range.first; n <= range.second; n++)
+            {
+                if (n >= CPU_SETSIZE || !CPU_ISSET (n, &allowed))
+                    throw std::invalid_argument ("CPU " + std::to_string (n) + " is not available");
+                list.push_back ((int)n);
+            }
+        }
+    }
+    else
+    {
+        for (int n = 0; n < CPU_SETSIZE; n++)
+        {
+            if (CPU_ISSET (n, &allowed))
+                list.push_back (n);
+        }
+    }
+
+    m_cpus.clear ();
+    if (mode == PIN_COMPACT)
+    {
+        m_cpus = list;
+        return;
+    }
+
+    // take one CPU of each node in turn
+    std::map<int, std::vector<int>> nodes;
+    for (auto cpu : list)
+        nodes[node (cpu)].push_back (cpu);
+    for (size_t n = 0; m_cpus.size () < list.size (); n++)
+    {
+        for (const auto& entry : nodes)
+        {
+            if (n < entry.second.size ())
+                m_cpus.push_back (entry.second[n]);
+        }
+    }
+}
+
+cAffinity::mode_t cAffinity::toMode (const std::string& s)
+{
+    if (s == "compact")
+        return PIN_COMPACT;
+    if (s == "rr")
+        return PIN_ROUND_ROBIN;
+    throw std::invalid_argument (s);
+}
+
+int cAffinity::cpu (unsigned n) const
+{
+    return m_cpus.empty () ? -1 : m_cpus[n % m_cpus.size ()];
+}
+
+int cAffinity::next ()
+{
+    return cpu (m_next++);
+}
+
+bool cAffinity::pin (int cpu)
+{
+    if (cpu < 0)
+        return true;
+
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (cpu, &set);
+    return !pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+}
+
+int cAffinity::current ()
+{
+    return sched_getcpu ();
+}
+
+int cAffinity::node (int cpu)
+{
+#ifdef HAVE_NUMA
+    if (numa_available () >= 0)
+    {
+        int node = numa_node_of_cpu (cpu);
+        return node < 0 ? 0 : node;
+    }
+#else
+    (void)cpu;
+#endif
+    return 0;
+}
+
+void* cAffinity::allocBuffer (size_t size, bool numaLocal)
+{
+#ifdef HAVE_NUMA
+    if (numaLocal && numa_available () >= 0)
+    {
+        void* p = numa_alloc_local (size);
+        if (!p)
+            throw std::bad_alloc ();
+        return p;
+    }
+#else
+    (void)numaLocal;
+#endif
+    // without NUMA support, the first write of the (pinned) thread places the pages
+    return ::operator new (size);
+}
+
+void cAffinity::freeBuffer (void* p, size_t size, bool numaLocal)
+{
+#ifdef HAVE_NUMA
+    if (numaLocal && numa_available () >= 0)
+    {
+        if (p)
+            numa_free (p, size);
+        return;
+    }
+#else
+    (void)size;
+    (void)numaLocal;
+#endif
+    ::operator delete (p);
+}
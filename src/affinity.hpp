@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <atomic>
+
+
+/**
+ * Assignment of threads (client connections, server workers) to CPUs.
+ *
+ * Thread n runs on the n-th CPU of the list, starting again at the beginning
+ * if there are more threads than CPUs. The order of the list depends on the
+ * mode: compact keeps the given order, so neighbouring threads share a NUMA
+ * node. Round robin alternates between the NUMA nodes of the list.
+ */
+class cAffinity
+{
+public:
+    enum mode_t
+    {
+        PIN_COMPACT,
+        PIN_ROUND_ROBIN
+    };
+
+    cAffinity (const cAffinity&) = delete;
+    cAffinity& operator=(const cAffinity&) = delete;
+    // pinning disabled
+    cAffinity () : m_next (0) {}
+
+    // cpus: e.g. "0-3,8", nullptr for all CPUs this process may use
+    // throws std::invalid_argument
+    void set (const char* cpus, mode_t mode);
+    // compact | rr
+    static mode_t toMode (const std::string& s);
+    bool isEnabled () const {return !m_cpus.empty ();}
+    unsigned count () const {return (unsigned)m_cpus.size ();}
+
+    // CPU of the n-th thread, -1 if pinning is disabled
+    int cpu (unsigned n) const;
+    // CPU of shard n (listener, its connections and reactor loop), CPU n if
+    // pinning is disabled, so that shards never share a CPU
+    int shardCpu (unsigned n) const {return m_cpus.empty () ? (int)n : cpu (n);}
+    // CPU of the next thread which has no fixed index
+    int next ();
+
+    // pins the calling thread to cpu (nothing if cpu < 0), returns false on failure
+    static bool pin (int cpu);
+    // CPU the calling thread currently runs on
+    static int current ();
+    // NUMA node of cpu, 0 without NUMA support
+    static int node (int cpu);
+
+    // numaLocal: buffer on the NUMA node of the calling thread, which must
+    // therefore already be pinned
+    static void* allocBuffer (size_t size, bool numaLocal);
+    static void freeBuffer (void* p, size_t size, bool numaLocal);
+
+private:
+    std::vector<int> m_cpus;  // in assignment order
+    std::atomic<unsigned> m_next;
+};
+
+#endif
@@ -17,7 +17,12 @@
  */
 
 #include <poll.h>
+#include <sys/resource.h>
 #include <cstring>
+#include <memory>
+#include <map>
+#include <thread>
+#include <chrono>
 #include "bug.hpp"
 #include "application.hpp"
 #include "client.hpp"
@@ -27,7 +32,10 @@
 #include "signal.hpp"
 #include "valueformatter.hpp"
 #include "comsettings.hpp"
+#include "protocoloptions.hpp"
 #include "valueparser.hpp"
+#include "affinity.hpp"
+#include "clientengine.hpp"
 
 
 
@@ -49,6 +57,35 @@ cApplication::cApplication(const char* name, const char* brief, const char* usag
             "Wait TIME in seconds between sending packets. Default is 0.0s.", &m_options.interval);
     addCmdLineOption (true, 'c', "count", "COUNT",
             "Stop after sending and receiving COUNT packets.", &m_options.count);
+    addCmdLineOption (true, 'w', "window", "N",
+            "Keep up to N requests per connection in flight (default 1, with --rate 1024). Requests and\n\t"
+            "responses of all outstanding requests should fit into the socket buffers of client and server.",
+            &m_options.window);
+    addCmdLineOption (true, 0, "rate", "R",
+            "Client only: open loop, send R requests per second and connection on a fixed schedule,\n\t"
+            "whether the responses arrive in time or not. Round trip times are measured from the\n\t"
+            "scheduled send time, the lag shows how far the sender fell behind. Implies --multiplex.",
+            &m_options.rate);
+    addCmdLineOption (true, 0, "total-rate", "R",
+            "Client only: like --rate, but R requests per second of all connections together.",
+            &m_options.totalRate);
+    addCmdLineOption (true, 0, "pace", "RATE",
+            "Client only: the kernel paces the requests of each connection to RATE bit/s (e.g. 250M),\n\t"
+            "TCP with SO_MAX_PACING_RATE, UDP with a launch time per datagram (SO_TXTIME). Launch times\n\t"
+            "need the fq qdisc on the outgoing interface (tc qdisc replace dev DEV root fq).",
+            &m_options.pace);
+    addCmdLineOption (true, 0, "poisson",
+            "Client only: with --rate, exponentially distributed times between requests (Poisson\n\t"
+            "arrivals) instead of a fixed interval.", &m_options.poisson);
+    addCmdLineOption (true, 0, "limit-bandwidth", "RATE[:BURST]",
+            "Client only: send the requests of all connections together with at most RATE bit/s\n\t"
+            "(e.g. 4G). After an idle time, up to BURST bytes (default: 1 ms of RATE, at least 64k) are\n\t"
+            "sent at once. Implies --multiplex.", &m_options.limitBandwidth);
+    addCmdLineOption (true, 0, "limit-requests", "R[:BURST]",
+            "Client only: send at most R requests per second with all connections together. After\n\t"
+            "an idle time, up to BURST requests (default: 1 ms of R, at least 1) are sent at once.\n\t"
+            "Implies --multiplex.",
+            &m_options.limitRequests);
     addCmdLineOption (true, 't', "time", "SECONDS",
             "Stop after running SECONDS.", &m_options.time);
     addCmdLineOption (true, 0, "send-bytes", "N",
@@ -65,6 +102,71 @@ cApplication::cApplication(const char* name, const char* brief, const char* usag
             "TODO, maybe split to single options", &m_options.comSettings);
     addCmdLineOption (true, 'b', nullptr,
             "Enable batch mode", &m_options.batchmode);
+    addCmdLineOption (true, 0, "verify", "MODE",
+            "Verification of received messages: 'full' (default) checks header and payload of every message,\n\t"
+            "'sampled[:N]' checks the payload of every Nth message only (default 16), 'header' checks\n\t"
+            "header checksum and sequence number only and 'none' disables all checks.", &m_options.verify);
+    addCmdLineOption (true, 0, "crc32c",
+            "Append a CRC32C over header and payload to each sent message. Received messages with\n\t"
+            "CRC32C are verified by checksum instead of the payload pattern.", &m_options.crc32c);
+    addCmdLineOption (true, 0, "payload", "TYPE",
+            "Payload content of sent messages: 'counter' (default), 'zero' or 'random'. Other content\n\t"
+            "than 'counter' implies --crc32c.", &m_options.payload);
+    addCmdLineOption (true, 0, "zerocopy",
+            "Send large messages (>= 16k) of stream sockets with MSG_ZEROCOPY. The statistics show how many\n\t"
+            "of them were copied by the kernel nevertheless (e.g. always on loopback). Not used by the\n\t"
+            "event loops of --multiplex and --reactor, waiting for the completions would stall them.",
+            &m_options.zerocopy);
+    addCmdLineOption (true, 0, "batch", "N",
+            "Receive and send up to N datagrams (max. 64) with one recvmmsg/sendmmsg call (default 1).\n\t"
+            "Only used by datagram protocols, clients need a window (-w) > 1 to profit from it.", &m_options.batch);
+    addCmdLineOption (true, 0, "udp-segment", "BYTES",
+            "Datagram protocols with --batch: up to 64 queued messages of equal size up to BYTES\n\t"
+            "(e.g. MTU minus IP/UDP headers) are handed to the kernel as one send (UDP GSO), which splits\n\t"
+            "it into one datagram per message. Also enables UDP GRO on receive if --buf-size is at least 64k.",
+            &m_options.udpSegment);
+    addCmdLineOption (true, 0, "io-engine", "ENGINE",
+            "Socket I/O: 'poll' (default) waits with poll before every receive, 'uring' uses one io_uring\n\t"
+            "per socket with multishot receive for stream sockets. Falls back to 'poll' if the kernel\n\t"
+            "doesn't support io_uring.", &m_options.ioEngine);
+    addCmdLineOption (true, 0, "busy-poll", "USEC",
+            "Busy polling for low latency: blocking receives spin up to USEC microseconds on the socket\n\t"
+            "before they sleep, and the kernel polls the device queue (SO_BUSY_POLL, SO_PREFER_BUSY_POLL,\n\t"
+            "values above net.core.busy_read need CAP_NET_ADMIN). Costs CPU time, see the 'cpu:' line.",
+            &m_options.busyPoll);
+    addCmdLineOption (true, 0, "reactor",
+            "Server only: serve TCP, SCTP and DCCP connections with one epoll event loop per CPU instead\n\t"
+            "of one thread per connection (max. 1000). Use a small --buf-size for lots of connections.",
+            &m_options.reactor);
+    addCmdLineOption (true, 0, "multiplex",
+            "Client only: drive all connections with one epoll event loop per CPU (of --cpus) instead of\n\t"
+            "one thread per connection. Use a small --buf-size for lots of connections.",
+            &m_options.multiplex);
+    addCmdLineOption (true, 0, "sharded",
+            "Server only: accept connections with one SO_REUSEPORT listener per CPU (per --reactor loop),\n\t"
+            "each with its own accept queue and thread. With --reactor, a listener hands its connections\n\t"
+            "only to its own event loop. Listener n, its connections and loop n run on CPU n (of --cpus).",
+            &m_options.sharded);
+    addCmdLineOption (true, 0, "incoming-cpu",
+            "Server only: UDP worker n prefers datagrams which were processed by CPU n (SO_INCOMING_CPU).",
+            &m_options.incomingCpu);
+    addCmdLineOption (true, 0, "cpus", "LIST",
+            "Pin client connections and server threads (workers, reactor loops, sharded listeners) to the\n\t"
+            "CPUs of LIST (e.g. 0-3,8), their buffers are allocated on the local NUMA node.\n\t"
+            "With --reactor or --sharded there is one loop or listener per CPU of LIST.", &m_options.cpus);
+    addCmdLineOption (true, 0, "pin", "MODE",
+            "Order in which threads are assigned to the CPUs (of --cpus or all): 'compact' (default) fills\n\t"
+            "them in the given order, 'rr' alternates between the NUMA nodes.", &m_options.pin);
+    addCmdLineOption (true, 0, "timestamps", "MODE",
+            "Client only: measure the round trip time also with kernel timestamps (SO_TIMESTAMPING),\n\t"
+            "which shows the time spent in the hosts separately. 'sw' uses software timestamps, 'hw'\n\t"
+            "additionally NIC timestamps (hardware timestamping must be enabled on the interface).",
+            &m_options.timestamps);
+    addCmdLineOption (true, 0, "one-way",
+            "Client only: timestamp requests and responses in the message header and split the round trip\n\t"
+            "time into request path, server time and response path. The clock offset between client and\n\t"
+            "server is estimated from the fastest round trips, so the clocks need not be synchronized.\n\t"
+            "Requests and responses need a payload of at least 24 bytes (28 with CRC32C).", &m_options.oneWay);
 }
 
 cApplication::~cApplication ()
@@ -104,12 +206,128 @@ int cApplication::execute (const std::list<std::string>& args)
         interval_us = (uint64_t)(interval * 1000000.0);
     }
 
-    if (m_options.sockBufSize < 64)
+    cProtocolOptions protoOptions;
+    if (m_options.verify)
+    {
+        try
+        {
+            protoOptions.setVerify (m_options.verify);
+        }
+        catch (const std::exception&)
+        {
+            Console::PrintError ("Invalid verification mode '%s'\n", m_options.verify);
+            return -2;
+        }
+    }
+    protoOptions.m_crc32c   = !!m_options.crc32c;
+    protoOptions.m_zerocopy = !!m_options.zerocopy;
+    protoOptions.m_headerTimestamps = !!m_options.oneWay;
+    if (m_options.payload)
+    {
+        try
+        {
+            protoOptions.setPayload (m_options.payload);
+        }
+        catch (const std::exception&)
+        {
+            Console::PrintError ("Invalid payload type '%s'\n", m_options.payload);
+            return -2;
+        }
+    }
+
+    if (m_options.pace)
+    {
+        try
+        {
+            protoOptions.m_pacingRate = cValueParser::bitRate (m_options.pace) / 8;
+        }
+        catch (const std::exception&)
+        {
+        }
+        if (!protoOptions.m_pacingRate)
+        {
+            Console::PrintError ("Invalid pacing rate '%s'\n", m_options.pace);
+            return -2;
+        }
+    }
+
+    if (m_options.timestamps)
+    {
+        try
+        {
+            protoOptions.setTimestamps (m_options.timestamps);
+        }
+        catch (const std::exception&)
+        {
+            Console::PrintError ("Invalid timestamp mode '%s'\n", m_options.timestamps);
+            return -2;
+        }
+    }
+
+    if (m_options.ioEngine)
+    {
+        if (!std::strcmp (m_options.ioEngine, "uring"))
+        {
+            if (!cSocket::setIoEngine (cSocket::IO_URING))
+                Console::PrintError ("io_uring is not supported, using poll\n");
+        }
+        else if (std::strcmp (m_options.ioEngine, "poll"))
+        {
+            Console::PrintError ("Invalid I/O engine '%s'\n", m_options.ioEngine);
+            return -2;
+        }
+    }
+
+    if (m_options.busyPoll < 0)
+    {
+        Console::PrintError ("Invalid busy poll time '%d'\n", m_options.busyPoll);
+        return -2;
+    }
+    cSocket::setBusyPoll ((unsigned)m_options.busyPoll);
+
+    cAffinity affinity;
+    if (m_options.cpus || m_options.pin)
+    {
+        try
+        {
+            affinity.set (m_options.cpus,
+                m_options.pin ? cAffinity::toMode (m_options.pin) : cAffinity::PIN_COMPACT);
+        }
+        catch (const std::exception& e)
+        {
+            Console::PrintError ("Invalid CPU pinning '%s': %s\n",
+                m_options.cpus ? m_options.cpus : m_options.pin, e.what());
+            return -2;
+        }
+        protoOptions.m_numaLocal = true;
+    }
+
+    if (m_options.sockBufSize < 1)
     {
         Console::PrintError ("Invalid socket buffer size '%d'\n", m_options.sockBufSize);
         return -2;
     }
 
+    if (m_options.batch < 1 || m_options.batch > (int)cProtocolOptions::MAX_BATCH)
+    {
+        Console::PrintError ("Invalid batch size '%d'\n", m_options.batch);
+        return -2;
+    }
+    protoOptions.m_batch = (unsigned)m_options.batch;
+
+    if (m_options.udpSegment < 0)
+    {
+        Console::PrintError ("Invalid segment size '%d'\n", m_options.udpSegment);
+        return -2;
+    }
+    protoOptions.m_udpSegment = (unsigned)m_options.udpSegment;
+
+    if (m_options.window < 0)
+    {
+        Console::PrintError ("Invalid window size '%d'\n", m_options.window);
+        return -2;
+    }
+
     if (!isServer)
     {
         if (args.size() != 1)
@@ -135,9 +353,83 @@ int cApplication::execute (const std::list<std::string>& args)
 
         cComSettings comSettings (m_options.comSettings);
 
+        // open loop: requests per second of each connection
+        double rate = 0;
+        const char* rateArg = m_options.rate ? m_options.rate : m_options.totalRate;
+        if (rateArg)
+        {
+            try
+            {
+                rate = std::stod (rateArg);
+            }
+            catch (const std::exception&)
+            {
+            }
+            if (rate <= 0 || (m_options.rate && m_options.totalRate) || m_options.interval)
+            {
+                Console::PrintError ("Invalid rate '%s' (--rate, --total-rate and -i exclude each other)\n", rateArg);
+                return -2;
+            }
+            if (!m_options.rate)
+            {
+                unsigned connections = 0;
+                for (const auto& range : remotePorts)
+                    connections += (unsigned)(range.second - range.first + 1);
+                rate /= (double)connections * m_options.clientConnections;
+            }
+        }
+        const unsigned window = m_options.window ? (unsigned)m_options.window : (rate > 0 ? 1024 : 1);
+
+        // token buckets shared by all connections, the default burst (1 ms) makes up
+        // for timers that expire late
+        std::unique_ptr<cTokenBucket> byteLimit, requestLimit;
+        if (m_options.limitBandwidth)
+        {
+            std::pair<uint64_t, uint64_t> limit (0, 0);
+            try
+            {
+                limit = cValueParser::rateLimit (m_options.limitBandwidth);
+            }
+            catch (const std::exception&)
+            {
+            }
+            if (limit.first < 8)
+            {
+                Console::PrintError ("Invalid bandwidth limit '%s'\n", m_options.limitBandwidth);
+                return -2;
+            }
+            const double bytesPerSecond = (double)limit.first / 8;
+            byteLimit.reset (new cTokenBucket (bytesPerSecond,
+                limit.second ? (double)limit.second : std::max (bytesPerSecond / 1000, 64.0 * 1024)));
+        }
+        if (m_options.limitRequests)
+        {
+            std::pair<uint64_t, uint64_t> limit (0, 0);
+            try
+            {
+                limit = cValueParser::rateLimit (m_options.limitRequests);
+            }
+            catch (const std::exception&)
+            {
+            }
+            if (!limit.first)
+            {
+                Console::PrintError ("Invalid request limit '%s'\n", m_options.limitRequests);
+                return -2;
+            }
+            requestLimit.reset (new cTokenBucket ((double)limit.first,
+                limit.second ? (double)limit.second : std::max ((double)limit.first / 1000, 1.0)));
+        }
+
         cSignal sigInt (SIGINT);
         cSignal sigAlarm (SIGALRM);
         cEvent evClientTerminated;
+        struct rusage usageStart;
+        getrusage (RUSAGE_SELF, &usageStart);
+        // the clients must be gone before their engine
+        // a blocking connection can't send while it waits for a response
+        std::unique_ptr<cClientEngine> engine (m_options.multiplex || rate > 0 || byteLimit || requestLimit ?
+            new cClientEngine (affinity.count (), &affinity) : nullptr);
         std::list<cClient> clients;
         unsigned clientID = 1;
         auto ports = args.cbegin(); ports++;
@@ -147,11 +439,14 @@ int cApplication::execute (const std::list<std::string>& args)
             {
                 for (auto dport = range.first; dport <= range.second; dport++)
                 {
+                    // connection n runs on the n-th CPU of the list (the loop of the engine)
+                    const int cpu = affinity.cpu (clientID - 1);
                     clients.emplace_back (clientID++, evClientTerminated, remoteHost,
                         (uint16_t)dport, localPort,
-                        interval_us, (unsigned)m_options.count, sendLimit, recvLimit,
-                        (unsigned)m_options.sockBufSize, comSettings,
-                        protocol);
+                        interval_us, (unsigned)m_options.count, window, sendLimit, recvLimit, rate, !!m_options.poisson,
+                        byteLimit.get (), requestLimit.get (),
+                        (unsigned)m_options.sockBufSize, comSettings, protoOptions,
+                        protocol, cpu, engine.get());
                 }
             }
         }
@@ -227,7 +522,8 @@ int cApplication::execute (const std::list<std::string>& args)
                     cStats statsDelta, statsSummary;
                     auto duration = cl.statistics (statsDelta, statsSummary);
 //                        Console::Print ("[%.1f sec][%s]\n", duration.second /1000.0, cl.getConnDescr().c_str());
-                    Console::Print ("\n[%u] [%s] [%.2f sec]\n", cl.getClientID(), cl.getConnDescr().c_str(), duration.second /1000.0);
+                    Console::Print ("\n[%u] [%s] [%s] [%.2f sec]\n", cl.getClientID(), cl.getConnDescr().c_str(),
+                        cl.getCpuDescr().c_str(), duration.second /1000.0);
                     printStatistics (statsDelta, duration.first, statsSummary, duration.second);
                 }
             }
@@ -239,7 +535,7 @@ int cApplication::execute (const std::list<std::string>& args)
         {
             cStats statsDelta, statsSummary;
             auto duration = cl.statistics (statsDelta, statsSummary);
-            Console::Print ("[%u][%s]\n", cl.getClientID(), cl.getConnDescr().c_str());
+            Console::Print ("[%u][%s][%s]\n", cl.getClientID(), cl.getConnDescr().c_str(), cl.getCpuDescr().c_str());
             printStatistics (statsSummary, duration.second);
 
             summaryAll  += statsSummary;
@@ -251,10 +547,15 @@ int cApplication::execute (const std::list<std::string>& args)
             Console::Print ("[all]\n");
             printStatistics (summaryAll, durationAll / clients.size());
         }
+        if (!clients.empty ())
+            printCpuTime (usageStart, durationAll / clients.size());
     }
     else
     {
         cSemaphore maxConnThreadCount (1000);
+        // declared before the servers, which use it until they are destroyed
+        std::unique_ptr<cReactor> reactor (m_options.reactor ?
+            new cReactor (affinity.count (), &affinity, !!m_options.sharded) : nullptr);
         std::list<cStatefulServer> servers;
         std::list<cStatelessServer> udpServers;
         auto portList = cValueParser::rangeList (m_options.serverPorts);
@@ -263,13 +564,53 @@ int cApplication::execute (const std::list<std::string>& args)
             for (auto port = range.first; port <= range.second; port++)
             {
                 servers.emplace_back (cSocket::Properties::tcp(!m_options.ipv6Only, !m_options.ipv4Only),
-                    (uint16_t)port, (unsigned)m_options.sockBufSize, maxConnThreadCount);
+                    (uint16_t)port, (unsigned)m_options.sockBufSize, protoOptions, maxConnThreadCount, reactor.get(),
+                    !!m_options.sharded, &affinity);
                 servers.emplace_back (cSocket::Properties::sctp(!m_options.ipv6Only, !m_options.ipv4Only),
-                    (uint16_t)port, (unsigned)m_options.sockBufSize, maxConnThreadCount);
+                    (uint16_t)port, (unsigned)m_options.sockBufSize, protoOptions, maxConnThreadCount, reactor.get(),
+                    !!m_options.sharded, &affinity);
                 servers.emplace_back (cSocket::Properties::dccp(!m_options.ipv6Only, !m_options.ipv4Only),
-                    (uint16_t)port, (unsigned)m_options.sockBufSize, maxConnThreadCount);
+                    (uint16_t)port, (unsigned)m_options.sockBufSize, protoOptions, maxConnThreadCount, reactor.get(),
+                    !!m_options.sharded, &affinity);
                 udpServers.emplace_back (cSocket::Properties::udp(!m_options.ipv6Only, !m_options.ipv4Only),
-                    (uint16_t)port, (unsigned)m_options.sockBufSize, maxConnThreadCount);
+                    (uint16_t)port, (unsigned)m_options.sockBufSize, protoOptions, maxConnThreadCount,
+                    !!m_options.incomingCpu, &affinity);
+            }
+        }
+
+        // the servers run until we are killed, meanwhile show how the kernel
+        // distributes the datagrams among the UDP workers
+        std::map<uint16_t, uint64_t> lastTotal;
+        std::map<uint16_t, cStats>   lastStats;
+        for (;;)
+        {
+            std::this_thread::sleep_for (std::chrono::seconds (std::max (m_options.statusUpdateTime, 1)));
+            for (const auto& server : udpServers)
+            {
+                auto requests = server.getWorkerRequests ();
+                uint64_t total = 0;
+                for (auto n : requests)
+                    total += n;
+                if (total == lastTotal[server.getPort ()])
+                    continue;
+                lastTotal[server.getPort ()] = total;
+
+                std::string line;
+                for (auto n : requests)
+                    line += " " + std::to_string (n);
+                Console::Print ("udp port %u requests per worker:%s\n", server.getPort (), line.c_str ());
+
+                // since the last output
+                if (m_options.batch > 1)
+                {
+                    const cStats stats = server.getStats ();
+                    const cStats delta = stats - lastStats[server.getPort ()];
+                    lastStats[server.getPort ()] = stats;
+                    Console::Print ("udp port %u batching: %.1f messages per send, %.1f per receive call\n",
+                        server.getPort (),
+                        delta.m_sendCalls ? (double)delta.m_sentPackets / delta.m_sendCalls : 0.0,
+                        delta.m_recvCalls ? (double)delta.m_receivedPackets / delta.m_recvCalls : 0.0);
+                }
             }
         }
     }
@@ -285,13 +626,82 @@ void cApplication::printStatistics (const cStats& stats, unsigned duration) cons
         duration = 1;
     Console::Print (
         "requests: %8" PRIuFAST64 ", %9sB, %8sbit/s\n"
-        "replies:  %8" PRIuFAST64 ", %9sB, %8sbit/s\n",
+        "replies:  %8" PRIuFAST64 ", %9sB, %8sbit/s\n"
+        "verified: %8" PRIuFAST64 ", %9sB\n",
         stats.m_sentPackets,
         cValueFormatter::toHumanReadable(stats.m_sentOctets, true).c_str(),
         cValueFormatter::toHumanReadable(stats.m_sentOctets * 8 * 1000 / duration, false).c_str(),
         stats.m_receivedPackets,
         cValueFormatter::toHumanReadable(stats.m_receivedOctets, true).c_str(),
-        cValueFormatter::toHumanReadable(stats.m_receivedOctets * 8 * 1000 / duration, false).c_str());
+        cValueFormatter::toHumanReadable(stats.m_receivedOctets * 8 * 1000 / duration, false).c_str(),
+        stats.m_verifiedPackets,
+        cValueFormatter::toHumanReadable(stats.m_verifiedOctets, true).c_str());
+    if (m_options.batch > 1)
+        Console::Print ("batching: %.1f messages per send, %.1f per receive call\n",
+            stats.m_sendCalls ? (double)stats.m_sentPackets / stats.m_sendCalls : 0.0,
+            stats.m_recvCalls ? (double)stats.m_receivedPackets / stats.m_recvCalls : 0.0);
+    if (m_options.udpSegment)
+        Console::Print ("segments: %.1f per send, %.1f per receive call\n",
+            stats.m_sendCalls ? (double)stats.m_sentSegments / stats.m_sendCalls : 0.0,
+            stats.m_recvCalls ? (double)stats.m_receivedSegments / stats.m_recvCalls : 0.0);
+    if (stats.m_zerocopySends)
+        Console::Print ("zerocopy: %8" PRIuFAST64 ", %" PRIuFAST64 " copied\n",
+            stats.m_zerocopySends, stats.m_zerocopyCopied);
+    printLatency ("latency: ", stats.m_latency);
+    printLatency ("kernel:  ", stats.m_kernelLatency);
+    printLatency ("nic:     ", stats.m_nicLatency);
+    printLatency ("host:    ", stats.m_hostLatency);
+    printOneWay (stats);
+    printLatency ("lag:     ", stats.m_sendLag);
+    printPacing (stats, duration);
+}
+
+void cApplication::printLatency (const char* title, const cLatencyHistogram& latency) const
+{
+    if (!latency.count ())
+        return;
+    // milliseconds, microsecond resolution
+    Console::Print ("%s min %.3f, mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f ms\n",
+        title,
+        latency.min () / 1e6, latency.mean () / 1e6,
+        latency.percentile (50.0) / 1e6, latency.percentile (90.0) / 1e6,
+        latency.percentile (99.0) / 1e6, latency.percentile (99.9) / 1e6,
+        latency.max () / 1e6);
+}
+
+void cApplication::printPacing (const cStats& stats, unsigned duration) const
+{
+    if (!stats.m_pacingRate)
+        return;
+    Console::Print ("pacing:   requested %sbit/s, achieved %sbit/s\n",
+        cValueFormatter::toHumanReadable (stats.m_pacingRate * 8, false).c_str(),
+        cValueFormatter::toHumanReadable (stats.m_sentOctets * 8 * 1000 / duration, false).c_str());
+}
+
+// CPU time of the whole process (all connections), e.g. to judge the cost of busy polling
+void cApplication::printCpuTime (const struct rusage& start, unsigned duration) const
+{
+    struct rusage end;
+    if (getrusage (RUSAGE_SELF, &end))
+        return;
+    auto seconds = [](const struct timeval& a, const struct timeval& b)
+    {
+        return (double)(b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1e6;
+    };
+    const double user = seconds (start.ru_utime, end.ru_utime);
+    const double sys  = seconds (start.ru_stime, end.ru_stime);
+    Console::Print ("cpu:      user %.2f s, system %.2f s, %.0f%% of one CPU\n",
+        user, sys, duration ? (user + sys) * 1e5 / duration : 0.0);
+}
+
+void cApplication::printOneWay (const cStats& stats) const
+{
+    printLatency ("request: ", stats.m_requestPath);
+    printLatency ("server:  ", stats.m_serverTime);
+    printLatency ("response:", stats.m_responsePath);
+    if (stats.m_clockOffsetDelay)
+        Console::Print ("offset:   %+.3f ms (server - client clock), from a round trip of %.3f ms\n",
+            stats.m_clockOffset / 1e6, stats.m_clockOffsetDelay / 1e6);
 }
 
 void cApplication::printStatistics (const cStats& stats, unsigned duration, const cStats& stats2, unsigned duration2) const
@@ -303,7 +713,8 @@ void cApplication::printStatistics (const cStats& stats, unsigned duration, cons
         duration2 = 1;
     Console::Print (
         "requests: %8" PRIuFAST64 ", %9sB, %8sbit/s | %8" PRIuFAST64 ", %9sB, %8sbit/s\n"
-        "replies:  %8" PRIuFAST64 ", %9sB, %8sbit/s | %8" PRIuFAST64 ", %9sB, %8sbit/s\n",
+        "replies:  %8" PRIuFAST64 ", %9sB, %8sbit/s | %8" PRIuFAST64 ", %9sB, %8sbit/s\n"
+        "verified: %8" PRIuFAST64 ", %9sB%16s| %8" PRIuFAST64 ", %9sB\n",
         stats2.m_sentPackets,
         cValueFormatter::toHumanReadable(stats2.m_sentOctets, true).c_str(),
         cValueFormatter::toHumanReadable(stats2.m_sentOctets * 8 * 1000 / duration2, false).c_str(),
@@ -315,7 +726,24 @@ void cApplication::printStatistics (const cStats& stats, unsigned duration, cons
         cValueFormatter::toHumanReadable(stats2.m_receivedOctets * 8 * 1000 / duration2, false).c_str(),
         stats.m_receivedPackets,
         cValueFormatter::toHumanReadable(stats.m_receivedOctets, true).c_str(),
-        cValueFormatter::toHumanReadable(stats.m_receivedOctets * 8 * 1000 / duration, false).c_str());
+        cValueFormatter::toHumanReadable(stats.m_receivedOctets * 8 * 1000 / duration, false).c_str(),
+        stats2.m_verifiedPackets,
+        cValueFormatter::toHumanReadable(stats2.m_verifiedOctets, true).c_str(), "",
+        stats.m_verifiedPackets,
+        cValueFormatter::toHumanReadable(stats.m_verifiedOctets, true).c_str());
+    if (stats2.m_zerocopySends)
+        Console::Print ("zerocopy: %8" PRIuFAST64 ", %9" PRIuFAST64 " copied%10s| %8" PRIuFAST64 ", %9" PRIuFAST64 " copied\n",
+            stats2.m_zerocopySends, stats2.m_zerocopyCopied, "",
+            stats.m_zerocopySends, stats.m_zerocopyCopied);
+    // since start and since the last status
+    printLatency ("latency: ", stats2.m_latency);
+    printLatency ("interval:", stats.m_latency);
+    printLatency ("kernel:  ", stats2.m_kernelLatency);
+    printLatency ("nic:     ", stats2.m_nicLatency);
+    printLatency ("host:    ", stats2.m_hostLatency);
+    printOneWay (stats2);
+    printLatency ("lag:     ", stats2.m_sendLag);
+    printPacing (stats, duration);
 #if 0
     Console::Print (
         "requsts/replies: %" PRIuFAST64 "/%" PRIuFAST64 ", %sB/%sB, %s/%sbit/s\n",
@@ -34,6 +34,12 @@ struct appOptions
     const char*  serverPorts;
     const char*  interval;
     int          count;
+    int          window;
+    const char*  rate;
+    const char*  totalRate;
+    int          poisson;
+    const char*  limitBandwidth;
+    const char*  limitRequests;
     int          time;
     const char*  sendLimit;
     const char*  recvLimit;
@@ -44,6 +50,23 @@ struct appOptions
     int          ipv6Only;
     const char*  comSettings;
     int          batchmode;
+    const char*  verify;
+    int          crc32c;
+    const char*  payload;
+    int          zerocopy;
+    int          batch;
+    int          udpSegment;
+    const char*  ioEngine;
+    int          reactor;
+    int          multiplex;
+    int          sharded;
+    int          incomingCpu;
+    const char*  cpus;
+    const char*  pin;
+    const char*  timestamps;
+    int          oneWay;
+    const char*  pace;
+    int          busyPoll;
 
     appOptions () :
         serverIP (nullptr),
@@ -51,6 +74,12 @@ struct appOptions
         serverPorts (nullptr),
         interval (nullptr),
         count (0),
+        window (0),
+        rate (nullptr),
+        totalRate (nullptr),
+        poisson (0),
+        limitBandwidth (nullptr),
+        limitRequests (nullptr),
         time (0),
         sendLimit (nullptr),
         recvLimit (nullptr),
@@ -60,12 +89,31 @@ struct appOptions
         ipv4Only (0),
         ipv6Only (0),
         comSettings ("1230,1400,12340,13500"),
-        batchmode (0)
+        batchmode (0),
+        verify (nullptr),
+        crc32c (0),
+        payload (nullptr),
+        zerocopy (0),
+        batch (1),
+        udpSegment (0),
+        ioEngine (nullptr),
+        reactor (0),
+        multiplex (0),
+        sharded (0),
+        incomingCpu (0),
+        cpus (nullptr),
+        pin (nullptr),
+        timestamps (nullptr),
+        oneWay (0),
+        pace (nullptr),
+        busyPoll (0)
     {
     }
 };
 
 class cStats;
+class cLatencyHistogram;
+struct rusage;
 
 class cApplication : public cCmdlineApp
 {
@@ -79,6 +127,10 @@ public:
 private:
     void printStatistics (const cStats& stats, unsigned duration) const;
     void printStatistics (const cStats& stats, unsigned duration, const cStats& stats2, unsigned duration2) const;
+    void printLatency (const char* title, const cLatencyHistogram& latency) const;
+    void printOneWay (const cStats& stats) const;
+    void printPacing (const cStats& stats, unsigned duration) const;
+    void printCpuTime (const struct rusage& start, unsigned duration) const;
     appOptions m_options;
 };
 
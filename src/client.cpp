@@ -31,13 +31,16 @@
 #include "console.hpp"
 #include "socket.hpp"
 #include "requestor.hpp"
+#include "affinity.hpp"
+#include "clientengine.hpp"
 
 cEvent cClient::m_eventCancel;
 
 cClient::cClient (unsigned clientID, cEvent& evTerminated, const std::string &server, uint16_t remotePort,
-    uint16_t localPort, uint64_t delay, unsigned count, int_fast64_t sendLimit, int_fast64_t recvLimit,
-    unsigned socketBufSize, const cComSettings& settings,
-    const cSocket::Properties& protocol)
+    uint16_t localPort, uint64_t delay, unsigned count, unsigned window, int_fast64_t sendLimit, int_fast64_t recvLimit,
+    double rate, bool poisson, cTokenBucket* byteLimit, cTokenBucket* requestLimit,
+    unsigned socketBufSize, const cComSettings& settings, const cProtocolOptions& options,
+    const cSocket::Properties& protocol, int cpu, cClientEngine* engine)
     : m_clientID (clientID),
       m_evTerminated (evTerminated),
       m_terminate(false),
@@ -47,19 +50,33 @@ cClient::cClient (unsigned clientID, cEvent& evTerminated, const std::string &se
       m_localPort (localPort),
       m_delay (delay),
       m_count (count),
+      m_window (window),
       m_sendLimit (sendLimit),
       m_recvLimit (recvLimit),
+      m_rate (rate),
+      m_poisson (poisson),
+      m_byteLimit (byteLimit),
+      m_requestLimit (requestLimit),
       m_socketBufSize (socketBufSize),
       m_settings (settings),
+      m_options (options),
       m_protocol (protocol),
+      m_socket (nullptr),
       m_requestor (nullptr),
+      m_jobs (0),
       m_connected (false),
+      m_cpu (cpu),
+      m_lastCpu (-1),
+      m_migrated (false),
       m_finishedTime (0),
       m_lastStatsTime (0)
 {
     m_connDescription = "NOT CONNECTED -> " + m_server + ":" + std::to_string(m_remotePort);
 
-    m_thread = new std::thread (&cClient::threadFunc, this);
+    if (engine)
+        engine->add (this);
+    else
+        m_thread = new std::thread (&cClient::threadFunc, this);
 }
 
 cClient::~cClient ()
@@ -68,6 +85,7 @@ cClient::~cClient ()
         m_thread->join ();
     delete m_thread;
     delete m_requestor;
+    delete m_socket;
 }
 
 void cClient::terminateAll ()
@@ -110,40 +128,66 @@ void cClient::setConnDescr (std::string& localAddr, std::string& remoteAddr)
 
 void cClient::threadFunc ()
 {
-    using namespace std::chrono;
+    // before the requestor allocates its buffers
+    if (!cAffinity::pin (m_cpu))
+        Console::PrintError ("[%u] Could not pin to CPU %d\n", getClientID(), m_cpu);
+    updateCpu ();
 
-    try
+    if (connect (false))
     {
-        cSocket sock = cSocket::connect (m_protocol, m_server, m_remotePort, m_localPort);
-        if (sock.isValid())
+        try
         {
-            m_requestor = new cRequestor (sock, m_socketBufSize, m_settings, m_delay, m_sendLimit, m_recvLimit);
-            std::string remote = sock.getpeername ();
-            std::string local  = sock.getsockname ();
-            setConnDescr (local, remote);
-            sock.setCancelEvent (m_eventCancel);
-
-            Console::Print ("[%u] Connected with %s to %s via %s\n",
-                getClientID(),
-                m_protocol.toString(),
-                remote.c_str(), local.c_str());
-
-            bool infinite = m_count == 0;
-            m_connected = true;
-
-            m_startTime = steady_clock::now();
-            while (!m_terminate)
+            // the requestor terminates with an eventException when count or limits are reached
+            // getcpu is cheap (vDSO), but not for free
+            for (m_jobs = 1; !m_terminate; m_jobs++)
             {
                 m_requestor->doJob ();
-
-                if (!infinite && --m_count == 0)
-                    m_terminate = true;
+                if (!(m_jobs % 256))
+                    updateCpu ();
             }
         }
-        else
+        catch (const cSocket::errorException& e)
+        {
+            Console::PrintError ("[%u] %s\n", getClientID(), e.what());
+        }
+        catch (const cSocket::eventException& e)
+        {
+        }
+    }
+    finish ();
+}
+
+bool cClient::connect (bool nonBlocking)
+{
+    using namespace std::chrono;
+
+    try
+    {
+        cSocket sock = cSocket::connect (m_protocol, m_server, m_remotePort, m_localPort);
+        if (!sock.isValid())
         {
             Console::PrintError ("[%u] Could not connect to %s\n", getClientID(), m_server.c_str());
+            return false;
         }
+        m_socket = new cSocket (std::move (sock));
+        if (nonBlocking)
+            m_socket->setNonBlocking ();
+        m_requestor = new cRequestor (*m_socket, m_socketBufSize, m_options, m_settings, m_delay,
+            m_count, m_window, m_sendLimit, m_recvLimit, m_rate, m_poisson,
+            m_byteLimit, m_requestLimit);
+        std::string remote = m_socket->getpeername ();
+        std::string local  = m_socket->getsockname ();
+        setConnDescr (local, remote);
+        m_socket->setCancelEvent (m_eventCancel);
+
+        Console::Print ("[%u] Connected with %s to %s via %s\n",
+            getClientID(),
+            m_protocol.toString(),
+            remote.c_str(), local.c_str());
+
+        m_connected = true;
+        m_startTime = steady_clock::now();
+        return true;
     }
     catch (const cSocket::errorException& e)
     {
@@ -152,8 +196,62 @@ void cClient::threadFunc ()
     catch (const cSocket::eventException& e)
     {
     }
+    return false;
+}
+
+cRequestor::state_t cClient::serve (unsigned budget)
+{
+    try
+    {
+        cRequestor::state_t state = m_requestor->serve (budget);
+        if (!(++m_jobs % 256))
+            updateCpu ();
+        return state;
+    }
+    catch (const cSocket::errorException& e)
+    {
+        Console::PrintError ("[%u] %s\n", getClientID(), e.what());
+    }
+    catch (const cProtocolException& e)
+    {
+        Console::PrintError ("[%u] %s\n", getClientID(), e.what());
+    }
+    catch (const cSocket::eventException& e)
+    {
+        // termination request, e.g. while waiting for zerocopy completions
+    }
+    // only this connection is lost
+    return cRequestor::DONE;
+}
+
+void cClient::finish ()
+{
+    using namespace std::chrono;
+
+    updateCpu ();
     auto end = steady_clock::now();
     m_finishedTime = duration_cast<milliseconds>(end - m_startTime).count();
 
+    // close the connection now. The socket object stays until we are destroyed,
+    // the requestor still references it for its statistics.
+    if (m_socket)
+        m_socket->close ();
+
     m_evTerminated.send();
 }
+
+void cClient::updateCpu ()
+{
+    int cpu  = cAffinity::current ();
+    int last = m_lastCpu.exchange (cpu);
+    if (last >= 0 && last != cpu)
+        m_migrated = true;
+}
+
+std::string cClient::getCpuDescr () const
+{
+    int cpu = m_lastCpu;
+    if (cpu < 0)
+        return "cpu ?";
+    return "cpu " + std::to_string (cpu) + (m_migrated ? ", migrated" : "");
+}
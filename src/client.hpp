@@ -31,28 +31,43 @@
 #include "event.hpp"
 #include "stats.hpp"
 #include "comsettings.hpp"
+#include "protocoloptions.hpp"
 #include "socket.hpp"
+#include "requestor.hpp"
 
-class cRequestor;
+class cClientEngine;
 
 class cClient
 {
 public:
     cClient (unsigned clientID, cEvent& evTerminated, const std::string &server, uint16_t remotePort,
-        uint16_t localPort, uint64_t delay, unsigned count, int_fast64_t sendLimit, int_fast64_t recvLimit,
-        unsigned socketBufSize, const cComSettings& settings,
-        const cSocket::Properties& proto);
+        uint16_t localPort, uint64_t delay, unsigned count, unsigned window, int_fast64_t sendLimit, int_fast64_t recvLimit,
+        double rate, bool poisson, cTokenBucket* byteLimit, cTokenBucket* requestLimit,
+        unsigned socketBufSize, const cComSettings& settings, const cProtocolOptions& options,
+        const cSocket::Properties& proto, int cpu = -1, cClientEngine* engine = nullptr);
     ~cClient ();
     static void terminateAll ();
+    static int cancelEvent () {return m_eventCancel;}
 
     std::pair<unsigned, unsigned> statistics (cStats& delta, cStats& summary);
     void threadFunc ();
     unsigned getClientID () const  {return m_clientID;}
     bool isConnected () const {return m_connected;}
     const std::string& getConnDescr () const {return m_connDescription;}
+    // CPU the connection ran on, e.g. "cpu 3" or "cpu 5, migrated"
+    std::string getCpuDescr () const;
+
+    // driven by an event loop of cClientEngine instead of an own thread.
+    // All of them are called by the loop thread.
+    bool connect (bool nonBlocking);
+    cRequestor::state_t serve (unsigned budget);
+    void finish ();
+    int nativeHandle () const {return m_socket->nativeHandle ();}
+    std::chrono::steady_clock::time_point getNotBefore () const {return m_requestor->getNotBefore ();}
 
 private:
     void setConnDescr (std::string& localAddr, std::string& remoteAddr);
+    void updateCpu ();
 
     const unsigned m_clientID;
     cEvent&       m_evTerminated;
@@ -63,14 +78,25 @@ private:
     uint16_t      m_localPort;
     uint64_t      m_delay;
     unsigned      m_count;
+    unsigned      m_window;
     int_fast64_t  m_sendLimit;
     int_fast64_t  m_recvLimit;
+    double        m_rate;
+    bool          m_poisson;
+    cTokenBucket* m_byteLimit;
+    cTokenBucket* m_requestLimit;
     unsigned      m_socketBufSize;
     cComSettings  m_settings;
+    const cProtocolOptions m_options;
     const cSocket::Properties m_protocol;
+    cSocket*      m_socket;
     cRequestor*   m_requestor;
+    unsigned      m_jobs;
     std::atomic<bool> m_connected;
     std::string   m_connDescription;
+    const int     m_cpu;           // pinned to, -1: not pinned
+    std::atomic<int>  m_lastCpu;   // last observed CPU
+    std::atomic<bool> m_migrated;  // ran on more than one CPU
 
     std::chrono::time_point<std::chrono::steady_clock> m_startTime;
     unsigned      m_finishedTime;
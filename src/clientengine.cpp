@@ -0,0 +1,372 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "clientengine.hpp"
+#include "client.hpp"
+#include "console.hpp"
+
+
+struct cClientEngine::cEntry
+{
+    explicit cEntry (cClient* client)
+        : m_client (client),
+          m_events (0),
+          m_watched (false),
+          m_queued (false),
+          m_scheduled (false),
+          m_closed (false)
+    {
+    }
+
+    cClient*          m_client;
+    uint32_t          m_events;    // watched epoll events
+    bool              m_watched;   // registered with epoll
+    bool              m_queued;    // in m_ready of its loop
+    bool              m_scheduled; // m_timer is valid
+    bool              m_closed;
+    timers_t::iterator m_timer;
+};
+
+
+cClientEngine::cClientEngine (unsigned threads, const cAffinity* affinity)
+{
+    if (!threads)
+    {
+        long numberOfCPUs = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = numberOfCPUs > 0 ? (unsigned)numberOfCPUs : 1;
+    }
+
+    // one file descriptor per connection, thousands of them are the purpose of the engine
+    struct rlimit limit;
+    if (!getrlimit (RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &limit);
+    }
+
+    for (unsigned n = 0; n < threads; n++)
+        m_loops.push_back (new cLoop (affinity ? affinity->cpu (n) : -1));
+}
+
+cClientEngine::~cClientEngine ()
+{
+    for (auto loop : m_loops)
+        delete loop;
+}
+
+void cClientEngine::add (cClient* client)
+{
+    m_loops[(client->getClientID () - 1) % m_loops.size ()]->add (client);
+}
+
+
+cClientEngine::cLoop::cLoop (int cpu)
+    : m_epfd (-1), m_timerfd (-1), m_cpu (cpu), m_terminate (false), m_cancelled (false)
+{
+    m_epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (m_epfd < 0)
+        throw cSocket::errorException (errno);
+    m_timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerfd < 0)
+    {
+        int err = errno;
+        ::close (m_epfd);
+        throw cSocket::errorException (err);
+    }
+
+    // the only events without client, they are told apart by their pointers.
+    // The cancel event is never read, it must stay signaled for all loops.
+    try
+    {
+        ctl (EPOLL_CTL_ADD, m_wakeup, EPOLLIN, nullptr);
+        ctl (EPOLL_CTL_ADD, m_timerfd, EPOLLIN, &m_timerfd);
+        ctl (EPOLL_CTL_ADD, cClient::cancelEvent (), EPOLLIN, &m_cancelled);
+    }
+    catch (...)
+    {
+        ::close (m_timerfd);
+        ::close (m_epfd);
+        throw;
+    }
+
+    m_thread = std::thread (&cLoop::threadFunc, this);
+}
+
+cClientEngine::cLoop::~cLoop ()
+{
+    terminate ();
+    m_thread.join ();
+
+    for (auto entry : m_active)
+        delete entry;
+    ::close (m_timerfd);
+    ::close (m_epfd);
+}
+
+void cClientEngine::cLoop::add (cClient* client)
+{
+    m_lock.lock ();
+    m_new.push_back (client);
+    m_lock.unlock ();
+    m_wakeup.send ();
+}
+
+void cClientEngine::cLoop::terminate ()
+{
+    m_terminate = true;
+    m_wakeup.send ();
+}
+
+void cClientEngine::cLoop::threadFunc ()
+{
+    Console::PrintDebug ("client loop started\n");
+    if (!cAffinity::pin (m_cpu))
+        Console::PrintError ("Could not pin client loop to CPU %d\n", m_cpu);
+
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    while (!m_terminate)
+    {
+        int ret = epoll_wait (m_epfd, events, MAX_EVENTS, m_ready.empty () ? -1 : 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            Console::PrintError ("%s\n", cSocket::errorException (errno).what ());
+            break;
+        }
+
+        std::deque<cEntry*> ready;
+        ready.swap (m_ready);
+        for (auto entry : ready)
+            entry->m_queued = false;
+
+        for (int n = 0; n < ret; n++)
+        {
+            void* ptr = events[n].data.ptr;
+            if (!ptr)
+                takeNewClients ();
+            else if (ptr == &m_timerfd)
+                expireTimers ();
+            else if (ptr == &m_cancelled)
+                cancel ();
+            else
+                serve (reinterpret_cast<cEntry*>(ptr));
+        }
+        for (auto entry : ready)
+            serve (entry);
+
+        // only now nobody references them any more
+        for (auto entry : m_closed)
+            delete entry;
+        m_closed.clear ();
+    }
+
+    Console::PrintDebug ("client loop terminated\n");
+}
+
+void cClientEngine::cLoop::takeNewClients ()
+{
+    m_wakeup.wait ();
+
+    std::vector<cClient*> added;
+    m_lock.lock ();
+    added.swap (m_new);
+    m_lock.unlock ();
+
+    // connected here, so that the buffers are allocated by the thread using them.
+    // Connecting blocks, but only once per client.
+    for (auto client : added)
+    {
+        if (m_cancelled || !client->connect (true))
+        {
+            client->finish ();
+            continue;
+        }
+        cEntry* entry = new cEntry (client);
+        m_active.insert (entry);
+        serve (entry);
+    }
+}
+
+void cClientEngine::cLoop::cancel ()
+{
+    m_cancelled = true;
+    ctl (EPOLL_CTL_DEL, cClient::cancelEvent (), 0, nullptr);
+
+    std::vector<cEntry*> active (m_active.begin (), m_active.end ());
+    for (auto entry : active)
+        close (entry);
+}
+
+void cClientEngine::cLoop::expireTimers ()
+{
+    uint64_t expirations;
+    if (read (m_timerfd, &expirations, sizeof (expirations)) < 0 && errno != EAGAIN)
+        throw cSocket::errorException (errno);
+
+    auto now = std::chrono::steady_clock::now ();
+    std::vector<cEntry*> expired;
+    for (auto it = m_timers.begin (); it != m_timers.end () && it->first <= now; )
+    {
+        it->second->m_scheduled = false;
+        expired.push_back (it->second);
+        it = m_timers.erase (it);
+    }
+    for (auto entry : expired)
+        serve (entry);
+    armTimer ();
+}
+
+void cClientEngine::cLoop::serve (cEntry* entry)
+{
+    // requests per round, so that a busy connection can't starve the others
+    const unsigned BUDGET = 64;
+
+    if (entry->m_closed)
+        return;
+    try
+    {
+        cRequestor::state_t state = entry->m_client->serve (BUDGET);
+        if (state != cRequestor::WANT_TIMER && state != cRequestor::WANT_READ_OR_TIMER)
+            unschedule (entry);
+
+        switch (state)
+        {
+        case cRequestor::DONE:
+            close (entry);
+            return;
+        case cRequestor::WANT_WRITE:
+            watch (entry, EPOLLOUT);
+            break;
+        case cRequestor::WANT_TIMER:
+            // not even a hangup of the peer is of interest until then
+            unwatch (entry);
+            schedule (entry, entry->m_client->getNotBefore ());
+            break;
+        case cRequestor::WANT_READ_OR_TIMER:
+            // open loop: the next request is due even if the response is late
+            watch (entry, EPOLLIN);
+            schedule (entry, entry->m_client->getNotBefore ());
+            break;
+        case cRequestor::WANT_READ:
+        case cRequestor::BUSY:
+            watch (entry, EPOLLIN);
+            break;
+        }
+        if (state == cRequestor::BUSY && !entry->m_queued)
+        {
+            entry->m_queued = true;
+            m_ready.push_back (entry);
+        }
+    }
+    catch (const cSocket::errorException& e)
+    {
+        Console::PrintError ("%s\n", e.what());
+        close (entry);
+    }
+}
+
+void cClientEngine::cLoop::close (cEntry* entry)
+{
+    unwatch (entry);
+    unschedule (entry);
+    if (entry->m_queued)
+        m_ready.erase (std::find (m_ready.begin (), m_ready.end (), entry));
+    entry->m_closed = true;
+    m_active.erase (entry);
+    m_closed.push_back (entry);
+
+    entry->m_client->finish ();
+}
+
+void cClientEngine::cLoop::watch (cEntry* entry, uint32_t events)
+{
+    if (entry->m_watched && entry->m_events == events)
+        return;
+
+    // level triggered, so a partially received response is reported again
+    ctl (entry->m_watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, entry->m_client->nativeHandle (), events, entry);
+    entry->m_events  = events;
+    entry->m_watched = true;
+}
+
+void cClientEngine::cLoop::unwatch (cEntry* entry)
+{
+    if (!entry->m_watched)
+        return;
+    ctl (EPOLL_CTL_DEL, entry->m_client->nativeHandle (), 0, nullptr);
+    entry->m_watched = false;
+}
+
+void cClientEngine::cLoop::schedule (cEntry* entry, std::chrono::steady_clock::time_point when)
+{
+    if (entry->m_scheduled && entry->m_timer->first == when)
+        return;
+    unschedule (entry);
+    entry->m_timer     = m_timers.insert (std::make_pair (when, entry));
+    entry->m_scheduled = true;
+    if (entry->m_timer == m_timers.begin ())
+        armTimer ();
+}
+
+void cClientEngine::cLoop::unschedule (cEntry* entry)
+{
+    if (!entry->m_scheduled)
+        return;
+    m_timers.erase (entry->m_timer);
+    entry->m_scheduled = false;
+}
+
+void cClientEngine::cLoop::armTimer ()
+{
+    // CLOCK_MONOTONIC is the clock of steady_clock on Linux.
+    // A zero value disarms the timer, so the earliest time is 1 ns.
+    struct itimerspec spec;
+    std::memset (&spec, 0, sizeof (spec));
+    if (!m_timers.empty ())
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            m_timers.begin ()->first.time_since_epoch ()).count ();
+        if (ns <= 0)
+            ns = 1;
+        spec.it_value.tv_sec  = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    if (timerfd_settime (m_timerfd, TFD_TIMER_ABSTIME, &spec, nullptr))
+        throw cSocket::errorException (errno);
+}
+
+void cClientEngine::cLoop::ctl (int op, int fd, uint32_t events, void* ptr)
+{
+    struct epoll_event ev;
+    std::memset (&ev, 0, sizeof (ev));
+    ev.events   = events;
+    ev.data.ptr = ptr;
+    if (epoll_ctl (m_epfd, op, fd, &ev))
+        throw cSocket::errorException (errno);
+}
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CLIENTENGINE_HPP
+#define CLIENTENGINE_HPP
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <unordered_set>
+
+#include "event.hpp"
+#include "affinity.hpp"
+
+class cClient;
+
+/**
+ * Drives client connections with a fixed number of event loops instead of one
+ * thread per connection.
+ *
+ * Each loop is a thread waiting with epoll on the (non-blocking) sockets of its
+ * clients. A requestor which has to wait for its interval (-i) or its next
+ * scheduled request (--rate) is put on the timer of the loop instead of
+ * sleeping. Client n is assigned to loop n, starting again with the first
+ * loop if there are more clients than loops.
+ * All clients must have finished before the engine is destroyed.
+ */
+class cClientEngine
+{
+public:
+    cClientEngine (const cClientEngine&) = delete;
+    cClientEngine& operator=(const cClientEngine&) = delete;
+
+    // threads == 0: one event loop per CPU, loop n is pinned to affinity->cpu (n)
+    explicit cClientEngine (unsigned threads = 0, const cAffinity* affinity = nullptr);
+    ~cClientEngine ();
+
+    // connects and serves the client in its loop, until it has finished
+    void add (cClient* client);
+    unsigned threads () const {return (unsigned)m_loops.size ();}
+
+private:
+    struct cEntry;
+    typedef std::multimap<std::chrono::steady_clock::time_point, cEntry*> timers_t;
+
+    class cLoop
+    {
+    public:
+        explicit cLoop (int cpu);
+        ~cLoop ();
+        void add (cClient* client);
+        void terminate ();
+
+    private:
+        void threadFunc ();
+        void takeNewClients ();
+        void cancel ();
+        void expireTimers ();
+        void serve (cEntry* entry);
+        void close (cEntry* entry);
+        void watch (cEntry* entry, uint32_t events);
+        void unwatch (cEntry* entry);
+        void schedule (cEntry* entry, std::chrono::steady_clock::time_point when);
+        void unschedule (cEntry* entry);
+        void armTimer ();
+        void ctl (int op, int fd, uint32_t events, void* ptr);
+
+        int                   m_epfd;
+        int                   m_timerfd;
+        int                   m_cpu;
+        cEvent                m_wakeup;
+        std::atomic<bool>     m_terminate;
+        bool                  m_cancelled;  // cClient::terminateAll
+        std::mutex            m_lock;       // protects m_new
+        std::vector<cClient*> m_new;        // added, not yet connected
+        std::unordered_set<cEntry*> m_active;
+        std::deque<cEntry*>   m_ready;      // budget exhausted, serve again without waiting
+        std::vector<cEntry*>  m_closed;     // deleted after the current round
+        timers_t              m_timers;     // waiting for their interval or schedule
+        std::thread           m_thread;
+    };
+
+    std::vector<cLoop*> m_loops;
+};
+
+#endif
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_CRC32
+#endif
+
+#include "crc32c.hpp"
+
+
+// reflected polynomial of CRC32C
+static const uint32_t POLY = 0x82f63b78;
+
+class cCrc32cTable
+{
+public:
+    cCrc32cTable ()
+    {
+        for (unsigned n = 0; n < 256; n++)
+        {
+            uint32_t crc = n;
+            for (int k = 0; k < 8; k++)
+                crc = (crc >> 1) ^ (POLY & (0 - (crc & 1)));
+            m_table[0][n] = crc;
+        }
+        for (unsigned n = 0; n < 256; n++)
+        {
+            for (int k = 1; k < 8; k++)
+                m_table[k][n] = (m_table[k - 1][n] >> 8) ^ m_table[0][m_table[k - 1][n] & 0xff];
+        }
+    }
+    uint32_t m_table[8][256];
+};
+
+static const cCrc32cTable table;
+
+static uint32_t updateTable (uint32_t crc, const uint8_t* p, size_t len)
+{
+    const uint32_t (*t)[256] = table.m_table;
+
+    while (len && ((uintptr_t)p & 7))
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    while (len >= 8)
+    {
+        uint64_t v;
+        std::memcpy (&v, p, sizeof (v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64 (v);
+#endif
+        v ^= crc;
+        crc = t[7][v & 0xff]         ^ t[6][(v >> 8) & 0xff] ^
+              t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+              t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+              t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+        p   += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+
+    return crc;
+}
+
+#ifdef HAVE_X86_CRC32
+
+__attribute__((target("sse4.2")))
+static uint32_t updateSse42 (uint32_t crc, const uint8_t* p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7))
+    {
+        crc = _mm_crc32_u8 (crc, *p++);
+        len--;
+    }
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t v;
+        std::memcpy (&v, p, sizeof (v));
+        crc64 = _mm_crc32_u64 (crc64, v);
+        p   += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4)
+    {
+        uint32_t v;
+        std::memcpy (&v, p, sizeof (v));
+        crc  = _mm_crc32_u32 (crc, v);
+        p   += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc = _mm_crc32_u8 (crc, *p++);
+
+    return crc;
+}
+
+static cCrc32c::update_t selectUpdate ()
+{
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("sse4.2") ? updateSse42 : updateTable;
+}
+
+cCrc32c::update_t cCrc32c::m_update = selectUpdate ();
+
+#else
+
+cCrc32c::update_t cCrc32c::m_update = updateTable;
+
+#endif
+
+const char* cCrc32c::implementation ()
+{
+#ifdef HAVE_X86_CRC32
+    if (m_update == updateSse42)
+        return "sse4.2";
+#endif
+    return "table";
+}
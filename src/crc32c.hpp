@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * CRC32C (Castagnoli), as used by iSCSI, SCTP and ext4.
+ *
+ * Uses the SSE4.2 crc32 instruction if the CPU supports it, otherwise a
+ * table driven implementation (slicing-by-8).
+ */
+class cCrc32c
+{
+public:
+    // extend crc by len bytes of data, start with crc = 0
+    static uint32_t extend (uint32_t crc, const void* data, size_t len)
+    {
+        return ~m_update (~crc, (const uint8_t*)data, len);
+    }
+
+    // name of the selected implementation (sse4.2, table)
+    static const char* implementation ();
+
+    typedef uint32_t (*update_t) (uint32_t, const uint8_t*, size_t);
+
+private:
+    static update_t m_update;
+};
+
+#endif
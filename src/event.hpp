@@ -24,6 +24,7 @@
 #include <cerrno>
 #include <cstring>
 #include <stdexcept>
+#include <atomic>
 
 #include "bug.hpp"
 #include "strerror.h"
@@ -31,7 +32,7 @@
 class cEvent
 {
 public:
-    cEvent (unsigned int initval = 0) : m_fd (-1)
+    cEvent (unsigned int initval = 0) : m_fd (-1), m_signaled (initval > 0)
     {
         errno = 0;
         m_fd = eventfd (initval, EFD_SEMAPHORE);
@@ -44,6 +45,7 @@ public:
         errno = 0;
         if (write (m_fd, &count, sizeof(count)) != sizeof (count))
             throwError (errno);
+        m_signaled.store (true, std::memory_order_release);
     }
     void wait ()
     {
@@ -53,6 +55,12 @@ public:
         if (read (m_fd, &count, sizeof (count)) != sizeof (count))
             throwError (errno);
     }
+    // true once the event has been sent, even if it has been consumed since.
+    // Lets hot paths check one-shot events (termination requests) without syscall.
+    bool isSignaled () const
+    {
+        return m_signaled.load (std::memory_order_acquire);
+    }
     operator int()
     {
         return m_fd;
@@ -72,6 +80,7 @@ private:
         throw std::runtime_error (ret ? ret : "");
     }
     int m_fd;
+    std::atomic<bool> m_signaled;
 };
 
 #endif
\ No newline at end of file
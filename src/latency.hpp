@@ -0,0 +1,223 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+
+
+/**
+ * Log-linear histogram of round trip times in nanoseconds (like HdrHistogram).
+ *
+ * Each power of two is divided into 128 buckets, so every value is known with
+ * a precision of better than 1%. Values above MAX_VALUE (100 s) are counted as
+ * MAX_VALUE. The buckets are allocated with the first value, an empty histogram
+ * costs (and copies) nothing.
+ * Histograms of different connections or intervals are merged by adding
+ * (and subtracting) their buckets.
+ */
+class cLatencyHistogram
+{
+public:
+    static const uint64_t MAX_VALUE = 100000000000ull; // 100 s
+    static const unsigned SUB_BITS  = 8;
+    static const unsigned SUB_COUNT = 1u << SUB_BITS;
+    static const unsigned HALF_COUNT = SUB_COUNT / 2;
+
+    cLatencyHistogram () : m_count (0), m_sum (0)
+    {
+    }
+
+    static unsigned index (uint64_t ns)
+    {
+        if (ns > MAX_VALUE)
+            ns = MAX_VALUE;
+        if (ns < SUB_COUNT)
+            return (unsigned)ns;
+        // the highest SUB_BITS bits select the bucket
+        const unsigned shift = 63 - (unsigned)__builtin_clzll (ns) - (SUB_BITS - 1);
+        return SUB_COUNT + (shift - 1) * HALF_COUNT + (unsigned)(ns >> shift) - HALF_COUNT;
+    }
+    static unsigned buckets ()
+    {
+        return index (MAX_VALUE) + 1;
+    }
+    // smallest value and width of a bucket
+    static uint64_t lowest (unsigned idx)
+    {
+        if (idx < SUB_COUNT)
+            return idx;
+        const unsigned shift = (idx - SUB_COUNT) / HALF_COUNT + 1;
+        return (uint64_t)((idx - SUB_COUNT) % HALF_COUNT + HALF_COUNT) << shift;
+    }
+    static uint64_t width (unsigned idx)
+    {
+        return idx < SUB_COUNT ? 1 : 1ull << ((idx - SUB_COUNT) / HALF_COUNT + 1);
+    }
+
+    void record (uint64_t ns)
+    {
+        if (m_counts.empty ())
+            m_counts.resize (buckets ());
+        m_counts[index (ns)]++;
+        m_count++;
+        m_sum += ns;
+    }
+
+    cLatencyHistogram& operator+= (const cLatencyHistogram& val)
+    {
+        if (val.m_counts.empty ())
+            return *this;
+        if (m_counts.empty ())
+            m_counts.resize (buckets ());
+        for (size_t n = 0; n < m_counts.size (); n++)
+            m_counts[n] += val.m_counts[n];
+        m_count += val.m_count;
+        m_sum   += val.m_sum;
+        return *this;
+    }
+    // val must be an older state of this histogram
+    cLatencyHistogram& operator-= (const cLatencyHistogram& val)
+    {
+        if (val.m_counts.empty ())
+            return *this;
+        for (size_t n = 0; n < m_counts.size (); n++)
+            m_counts[n] -= val.m_counts[n];
+        m_count -= val.m_count;
+        m_sum   -= val.m_sum;
+        return *this;
+    }
+
+    uint64_t count () const {return m_count;}
+    double mean () const {return m_count ? (double)m_sum / m_count : 0.0;}
+    // all in nanoseconds, 0 for an empty histogram
+    uint64_t min () const;
+    uint64_t max () const;
+    // percent: e.g. 99.9
+    uint64_t percentile (double percent) const;
+
+private:
+    friend class cSharedLatencyHistogram;
+
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count;
+    uint64_t m_sum;
+};
+
+inline uint64_t cLatencyHistogram::min () const
+{
+    for (size_t n = 0; n < m_counts.size (); n++)
+    {
+        if (m_counts[n])
+            return lowest ((unsigned)n);
+    }
+    return 0;
+}
+
+inline uint64_t cLatencyHistogram::max () const
+{
+    for (size_t n = m_counts.size (); n > 0; n--)
+    {
+        if (m_counts[n - 1])
+            return lowest ((unsigned)n - 1) + width ((unsigned)n - 1) - 1;
+    }
+    return 0;
+}
+
+inline uint64_t cLatencyHistogram::percentile (double percent) const
+{
+    if (!m_count)
+        return 0;
+    uint64_t rank = (uint64_t)(percent / 100.0 * m_count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t n = 0; n < m_counts.size (); n++)
+    {
+        seen += m_counts[n];
+        if (seen >= rank)
+            return lowest ((unsigned)n) + width ((unsigned)n) / 2;
+    }
+    return max ();
+}
+
+
+/**
+ * cLatencyHistogram with a single writer (the I/O thread) and any number of
+ * readers.
+ *
+ * Every bucket is an atomic counter which only the writer modifies, so neither
+ * the writer nor the readers wait and no locked instruction is needed. A
+ * snapshot is not atomic as a whole, values recorded while reading are
+ * counted in the next one.
+ */
+class cSharedLatencyHistogram
+{
+public:
+    cSharedLatencyHistogram ()
+        : m_counts (new std::atomic<uint64_t>[cLatencyHistogram::buckets ()]),
+          m_sum (0)
+    {
+        for (unsigned n = 0; n < cLatencyHistogram::buckets (); n++)
+            m_counts[n].store (0, std::memory_order_relaxed);
+    }
+    ~cSharedLatencyHistogram ()
+    {
+        delete[] m_counts;
+    }
+    cSharedLatencyHistogram (const cSharedLatencyHistogram&) = delete;
+    cSharedLatencyHistogram& operator=(const cSharedLatencyHistogram&) = delete;
+
+    // writer only
+    void record (uint64_t ns)
+    {
+        increment (m_counts[cLatencyHistogram::index (ns)], 1);
+        increment (m_sum, ns);
+    }
+
+    // can be called by any thread
+    void read (cLatencyHistogram& histogram) const
+    {
+        histogram.m_counts.resize (cLatencyHistogram::buckets ());
+        histogram.m_count = 0;
+        histogram.m_sum   = m_sum.load (std::memory_order_relaxed);
+        for (unsigned n = 0; n < cLatencyHistogram::buckets (); n++)
+        {
+            histogram.m_counts[n] = m_counts[n].load (std::memory_order_relaxed);
+            histogram.m_count    += histogram.m_counts[n];
+        }
+        if (!histogram.m_count)
+            histogram = cLatencyHistogram ();
+    }
+
+private:
+    static void increment (std::atomic<uint64_t>& counter, uint64_t val)
+    {
+        counter.store (counter.load (std::memory_order_relaxed) + val, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t>* m_counts;
+    std::atomic<uint64_t>  m_sum;
+};
+
+#endif
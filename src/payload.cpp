@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <new> // bad_alloc
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#include "payload.hpp"
+
+
+static void fillScalar (uint8_t* buf, size_t len, uint8_t& counter, bool incr)
+{
+    const uint8_t step = incr ? 1 : 0xff;
+    uint8_t c = counter;
+    while (len--)
+    {
+        c += step;
+        *buf++ = c;
+    }
+    counter = c;
+}
+
+static size_t checkScalar (const uint8_t* buf, size_t len, uint8_t& expVal, bool incr)
+{
+    const uint8_t step = incr ? 1 : 0xff;
+    uint8_t c = expVal;
+    for (size_t n = 0; n < len; n++)
+    {
+        c += step;
+        if (buf[n] != c)
+        {
+            expVal = c;
+            return n;
+        }
+    }
+    expVal = c;
+    return len;
+}
+
+#ifdef HAVE_X86_SIMD
+
+// returns a vector with the values counter+1, counter+2, ... (resp. counter-1, ...)
+static inline __m128i sse2Start (uint8_t counter, bool incr)
+{
+    const __m128i up   = _mm_setr_epi8 (1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+    const __m128i base = _mm_set1_epi8 ((char)counter);
+    return incr ? _mm_add_epi8 (base, up) : _mm_sub_epi8 (base, up);
+}
+
+static void fillSse2 (uint8_t* buf, size_t len, uint8_t& counter, bool incr)
+{
+    __m128i v          = sse2Start (counter, incr);
+    const __m128i step = _mm_set1_epi8 (incr ? 16 : -16);
+    const size_t blocks = len / 16;
+
+    for (size_t n = 0; n < blocks; n++)
+    {
+        _mm_storeu_si128 ((__m128i*)buf, v);
+        v    = _mm_add_epi8 (v, step);
+        buf += 16;
+    }
+    counter += (uint8_t)(incr ? blocks * 16 : 0 - blocks * 16);
+    fillScalar (buf, len % 16, counter, incr);
+}
+
+static size_t checkSse2 (const uint8_t* buf, size_t len, uint8_t& expVal, bool incr)
+{
+    __m128i v          = sse2Start (expVal, incr);
+    const __m128i step = _mm_set1_epi8 (incr ? 16 : -16);
+    const size_t blocks = len / 16;
+
+    for (size_t n = 0; n < blocks; n++)
+    {
+        unsigned mask = (unsigned)_mm_movemask_epi8 (
+            _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*)(buf + n * 16)), v));
+        if (mask != 0xffff)
+        {
+            // let the scalar version find the exact position and value
+            expVal += (uint8_t)(incr ? n * 16 : 0 - n * 16);
+            return n * 16 + checkScalar (buf + n * 16, 16, expVal, incr);
+        }
+        v = _mm_add_epi8 (v, step);
+    }
+    expVal += (uint8_t)(incr ? blocks * 16 : 0 - blocks * 16);
+    return blocks * 16 + checkScalar (buf + blocks * 16, len % 16, expVal, incr);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2Start (uint8_t counter, bool incr)
+{
+    const __m256i up   = _mm256_setr_epi8 ( 1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16,
+                                           17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32);
+    const __m256i base = _mm256_set1_epi8 ((char)counter);
+    return incr ? _mm256_add_epi8 (base, up) : _mm256_sub_epi8 (base, up);
+}
+
+__attribute__((target("avx2")))
+static void fillAvx2 (uint8_t* buf, size_t len, uint8_t& counter, bool incr)
+{
+    __m256i v0         = avx2Start (counter, incr);
+    const __m256i step = _mm256_set1_epi8 (incr ? 32 : -32);
+    __m256i v1         = _mm256_add_epi8 (v0, step);
+    const __m256i step2 = _mm256_add_epi8 (step, step);
+    const size_t blocks = len / 64;
+
+    for (size_t n = 0; n < blocks; n++)
+    {
+        _mm256_storeu_si256 ((__m256i*)buf, v0);
+        _mm256_storeu_si256 ((__m256i*)(buf + 32), v1);
+        v0   = _mm256_add_epi8 (v0, step2);
+        v1   = _mm256_add_epi8 (v1, step2);
+        buf += 64;
+    }
+    counter += (uint8_t)(incr ? blocks * 64 : 0 - blocks * 64);
+    fillSse2 (buf, len % 64, counter, incr);
+}
+
+__attribute__((target("avx2")))
+static size_t checkAvx2 (const uint8_t* buf, size_t len, uint8_t& expVal, bool incr)
+{
+    __m256i v0         = avx2Start (expVal, incr);
+    const __m256i step = _mm256_set1_epi8 (incr ? 32 : -32);
+    __m256i v1         = _mm256_add_epi8 (v0, step);
+    const __m256i step2 = _mm256_add_epi8 (step, step);
+    const size_t blocks = len / 64;
+
+    for (size_t n = 0; n < blocks; n++)
+    {
+        const __m256i eq = _mm256_and_si256 (
+            _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*)(buf + n * 64)), v0),
+            _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*)(buf + n * 64 + 32)), v1));
+        if ((unsigned)_mm256_movemask_epi8 (eq) != 0xffffffff)
+        {
+            expVal += (uint8_t)(incr ? n * 64 : 0 - n * 64);
+            return n * 64 + checkScalar (buf + n * 64, 64, expVal, incr);
+        }
+        v0 = _mm256_add_epi8 (v0, step2);
+        v1 = _mm256_add_epi8 (v1, step2);
+    }
+    expVal += (uint8_t)(incr ? blocks * 64 : 0 - blocks * 64);
+    return blocks * 64 + checkSse2 (buf + blocks * 64, len % 64, expVal, incr);
+}
+
+static cPayload::fill_t selectFill ()
+{
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("avx2") ? fillAvx2 : fillSse2;
+}
+static cPayload::check_t selectCheck ()
+{
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("avx2") ? checkAvx2 : checkSse2;
+}
+
+cPayload::fill_t  cPayload::m_fill  = selectFill ();
+cPayload::check_t cPayload::m_check = selectCheck ();
+
+#else
+
+cPayload::fill_t  cPayload::m_fill  = fillScalar;
+cPayload::check_t cPayload::m_check = checkScalar;
+
+#endif
+
+const char* cPayload::implementation ()
+{
+#ifdef HAVE_X86_SIMD
+    if (m_check == checkAvx2)
+        return "avx2";
+    if (m_check == checkSse2)
+        return "sse2";
+#endif
+    return "scalar";
+}
+
+
+std::atomic<const cPayloadCache::cRegion*> cPayloadCache::m_current (nullptr);
+std::mutex cPayloadCache::m_lock;
+std::list<cPayloadCache::cRegion> cPayloadCache::m_regions;
+
+const cPayloadCache::cRegion* cPayloadCache::grow (size_t len)
+{
+    std::lock_guard<std::mutex> lock (m_lock);
+
+    // someone else might have been faster
+    const cRegion* r = m_current.load (std::memory_order_relaxed);
+    if (r && r->m_len >= len)
+        return r;
+
+    const size_t page = (size_t)sysconf (_SC_PAGESIZE);
+    const size_t size = ((len + 256 + page - 1) / page) * page;
+
+    // incr, decr, zero, random
+    void* mem[4] = {nullptr, nullptr, nullptr, nullptr};
+    for (auto& m : mem)
+    {
+        if (posix_memalign (&m, page, size))
+        {
+            for (auto& f : mem)
+                free (f);
+            throw std::bad_alloc ();
+        }
+    }
+    cRegion region;
+    region.m_incr   = (uint8_t*)mem[0];
+    region.m_decr   = (uint8_t*)mem[1];
+    region.m_zero   = (uint8_t*)mem[2];
+    region.m_random = (uint8_t*)mem[3];
+    region.m_len    = size - 256;
+
+    // both counter regions start with value 0
+    uint8_t counter = 0xff;
+    cPayload::fill (region.m_incr, size, counter, true);
+    counter = 0x01;
+    cPayload::fill (region.m_decr, size, counter, false);
+
+    std::memset (region.m_zero, 0, size);
+    std::mt19937 rng;
+    for (size_t n = 0; n < size; n += sizeof (uint32_t))
+    {
+        uint32_t v = rng ();
+        std::memcpy (region.m_random + n, &v, sizeof (v));
+    }
+
+    // old regions are kept, because other threads might still use them
+    m_regions.push_back (region);
+    m_current.store (&m_regions.back (), std::memory_order_release);
+
+    return &m_regions.back ();
+}
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOAD_HPP
+#define PAYLOAD_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <list>
+
+/**
+ * Generation and verification of the babbler payload pattern.
+ *
+ * The payload of each message is a byte counter which starts with the low byte
+ * of the sequence number and is incremented (requests) or decremented
+ * (responses) for each byte, i.e. the first payload byte is counter+1 resp. counter-1.
+ *
+ * The kernels are vectorized (SSE2/AVX2) and selected at runtime depending on the
+ * capabilities of the CPU. On other architectures a scalar implementation is used.
+ */
+class cPayload
+{
+public:
+    // write len bytes of the pattern to buf, counter is updated to the last written value
+    static void fill (uint8_t* buf, size_t len, uint8_t& counter, bool incr)
+    {
+        m_fill (buf, len, counter, incr);
+    }
+
+    // verify len bytes of buf, expVal is updated to the last verified value
+    // returns the offset of the first mismatching byte or len if everything is fine
+    static size_t check (const uint8_t* buf, size_t len, uint8_t& expVal, bool incr)
+    {
+        return m_check (buf, len, expVal, incr);
+    }
+
+    // name of the selected implementation (scalar, sse2, avx2)
+    static const char* implementation ();
+
+    typedef void   (*fill_t)  (uint8_t*, size_t, uint8_t&, bool);
+    typedef size_t (*check_t) (const uint8_t*, size_t, uint8_t&, bool);
+
+private:
+    static fill_t  m_fill;
+    static check_t m_check;
+};
+
+/**
+ * Shared read-only copies of the payload content.
+ *
+ * The counter pattern only depends on the start value (low byte of the sequence
+ * number) and the direction. Because it repeats every 256 bytes, one region per
+ * direction is enough, every start value is just a different offset into it.
+ * Zero and random content don't depend on the message at all.
+ * The regions grow on demand and are never released, so returned pointers stay
+ * valid for the lifetime of the process.
+ */
+class cPayloadCache
+{
+public:
+    enum content_t
+    {
+        COUNTER, // the babbler payload pattern (see cPayload)
+        ZERO,    // all bytes are zero
+        RANDOM   // random bytes, only verifiable with a checksum
+    };
+
+    // returns len bytes of content, start and incr are only used by COUNTER
+    static const uint8_t* get (content_t content, uint8_t start, bool incr, size_t len)
+    {
+        const cRegion* r = m_current.load (std::memory_order_acquire);
+        if (!r || r->m_len < len)
+            r = grow (len);
+        switch (content)
+        {
+        case ZERO:
+            return r->m_zero;
+        case RANDOM:
+            return r->m_random;
+        default:
+            return incr ? r->m_incr + (uint8_t)(start + 1) : r->m_decr + (uint8_t)(1 - start);
+        }
+    }
+
+private:
+    struct cRegion
+    {
+        uint8_t* m_incr;
+        uint8_t* m_decr;
+        uint8_t* m_zero;
+        uint8_t* m_random;
+        size_t   m_len;  // usable length for any start value
+    };
+    static const cRegion* grow (size_t len);
+
+    static std::atomic<const cRegion*> m_current;
+    static std::mutex m_lock;
+    static std::list<cRegion> m_regions;
+};
+
+#endif
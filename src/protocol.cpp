@@ -26,8 +26,12 @@
 #include <thread>
 #include <mutex>
 #include <algorithm>
+#include <cstring>
 
 #include "protocol.hpp"
+#include "payload.hpp"
+#include "crc32c.hpp"
+#include "affinity.hpp"
 
 #include "bug.hpp"
 #include "socket.hpp"
@@ -36,16 +40,120 @@
 
 
 
-cBabblerProtocol::cBabblerProtocol (cSocket& sock, unsigned bufsize) : m_socket (sock), m_bufsize (bufsize)
+cBabblerProtocol::cBabblerProtocol (cSocket& sock, unsigned bufsize, const cProtocolOptions& options)
+    : m_socket (sock), m_bufsize (bufsize), m_options (options), m_sampleCounter (0)
 {
-    m_buf  = new uint8_t[bufsize];
-    m_pBuf = m_buf;
     m_bufContentSize = 0;
+
+    m_isStream    = m_socket.isStream ();
+    // datagram sockets might be shared by several threads, which would mix up
+    // the completion notifications -> zerocopy only for streams.
+    // Waiting for a completion would stall the whole event loop of a non-blocking socket.
+    m_zerocopy    = m_options.m_zerocopy && m_isStream && !m_socket.isNonBlocking () &&
+        m_socket.enableZerocopy ();
+    m_timestamping  = false;
+    m_pacingRate    = 0;
+    m_txTimestampId = 0;
+    m_txSlot      = 0;
+    std::memset (m_txSlots, 0, sizeof (m_txSlots));
+    m_txCurSlot   = nullptr;
+    m_txTotal     = 0;
+    m_txSent      = 0;
+
+    m_batch       = m_isStream ? 1 : std::max (1u, std::min (m_options.m_batch, (unsigned)cProtocolOptions::MAX_BATCH));
+
+    // GSO merges queued messages, so it needs batch mode
+    m_segment = std::min ((size_t)m_options.m_udpSegment, m_bufsize);
+    m_gso     = false;
+    m_gro     = false;
+    if (!m_isStream && m_options.m_udpSegment)
+    {
+        m_gso = m_batch > 1 && m_socket.supportsUdpSegmentation ();
+        // coalesced datagrams are up to 64k, smaller buffers would truncate them
+        m_gro = m_bufsize >= 65536 && m_socket.enableUdpGro ();
+    }
+
+    m_txQueued    = 0;
+    m_txMsgs      = nullptr;
+    m_txIov       = nullptr;
+    m_txAddr      = nullptr;
+    m_txLast      = nullptr;
+    m_txWhole     = nullptr;
+    m_txGsoMsgs   = nullptr;
+    m_txGsoIov    = nullptr;
+    m_txGsoControl = nullptr;
+    m_rxMsgs      = nullptr;
+    m_rxIov       = nullptr;
+    m_rxAddr      = nullptr;
+    m_rxControl   = nullptr;
+    m_rxReceived  = 0;
+    m_rxNext      = 0;
+    // batch mode: one receive buffer per datagram
+    m_bufAllocSize = (size_t)m_batch * bufsize;
+    m_buf  = (uint8_t*)cAffinity::allocBuffer (m_bufAllocSize, m_options.m_numaLocal);
+    m_pBuf = m_buf;
+    if (m_batch > 1)
+    {
+        m_txMsgs = new struct mmsghdr[m_batch];
+        m_txIov  = new struct iovec[m_batch][4];
+        m_txAddr = new sockaddr_storage[m_batch];
+        m_txLast = new bool[m_batch];
+        m_txWhole = new bool[m_batch];
+        if (m_gso)
+        {
+            m_txGsoMsgs    = new struct mmsghdr[m_batch];
+            m_txGsoIov     = new struct iovec[m_batch * 4];
+            m_txGsoControl = new uint8_t[m_batch * cSocket::GSO_CONTROL_SIZE];
+        }
+        m_rxMsgs = new struct mmsghdr[m_batch];
+        m_rxIov  = new struct iovec[m_batch];
+        m_rxAddr = new sockaddr_storage[m_batch];
+        m_rxControl = new uint8_t[m_batch * cSocket::RX_CONTROL_SIZE];
+        std::memset (m_rxMsgs, 0, m_batch * sizeof (*m_rxMsgs));
+        for (unsigned n = 0; n < m_batch; n++)
+        {
+            m_rxIov[n].iov_base = m_buf + n * bufsize;
+            m_rxIov[n].iov_len  = bufsize;
+            m_rxMsgs[n].msg_hdr.msg_iov    = &m_rxIov[n];
+            m_rxMsgs[n].msg_hdr.msg_iovlen = 1;
+            m_rxMsgs[n].msg_hdr.msg_name   = &m_rxAddr[n];
+        }
+    }
+
+    m_rxState     = RX_HEADER;
+    m_rxHeaderLen = 0;
+    m_rxLength    = 0;
+    m_rxContentEnd = 0;
+    m_rxOffset    = 0;
+    m_rxExpVal    = 0;
+    m_rxIsRequest = false;
+    m_rxVerify    = false;
+    m_rxCrc       = false;
+    m_rxCrcValue  = 0;
+    m_rxTrailer   = 0;
+    m_rxHasTimestamps = false;
+    m_rxTimestamps.init (0);
+    m_rxTime      = 0;
+
+    // make sure that the shared payload content covers at least one buffer
+    cPayloadCache::get (m_options.m_payload, 0, true, bufsize);
 }
 cBabblerProtocol::~cBabblerProtocol ()
 {
     m_pBuf = nullptr;
-    delete[] m_buf;
+    cAffinity::freeBuffer (m_buf, m_bufAllocSize, m_options.m_numaLocal);
+    delete[] m_txMsgs;
+    delete[] m_txIov;
+    delete[] m_txAddr;
+    delete[] m_txLast;
+    delete[] m_txWhole;
+    delete[] m_txGsoMsgs;
+    delete[] m_txGsoIov;
+    delete[] m_txGsoControl;
+    delete[] m_rxMsgs;
+    delete[] m_rxIov;
+    delete[] m_rxAddr;
+    delete[] m_rxControl;
 }
 void cBabblerProtocol::sendRequest (uint64_t seq, unsigned reqSize, unsigned respSize)
 {
@@ -58,142 +166,570 @@ void cBabblerProtocol::sendRequest (uint64_t seq, unsigned reqSize, unsigned res
     BUG_ON (reqSize < sizeof (cProtocolHeader));
     reqSize  -= sizeof (cProtocolHeader);
 
-    cProtocolHeader* h = (cProtocolHeader*)m_buf;
-    h->initRequest (seq, reqSize, respSize);
-    send (h, reqSize, true);
+    const bool crc = m_options.useCrc32c () && reqSize >= sizeof (uint32_t);
+    const bool ts  = m_options.m_headerTimestamps &&
+        reqSize >= sizeof (cProtocolTimestamps) + (crc ? sizeof (uint32_t) : 0);
+    cTxSlot& slot  = nextTxSlot ();
+    slot.m_header.initRequest (seq, reqSize, respSize,
+        (crc ? cProtocolHeader::FLAG_CRC32C : 0) | (ts ? cProtocolHeader::FLAG_TIMESTAMPS : 0));
+    if (ts)
+        slot.m_timestamps.init (wallClock ());
+    send (slot, reqSize, true, crc, ts);
 }
 void cBabblerProtocol::sendResponse (uint64_t seq, unsigned respSize,
     const struct sockaddr *dest_addr, socklen_t addrlen)
 {
-    cProtocolHeader* h = (cProtocolHeader*)m_buf;
-    h->initResponse (seq, respSize);
-    send (h, respSize, false, dest_addr, addrlen);
+    // answer with CRC32C if the request also had one
+    const bool crc = (m_options.useCrc32c () || (m_rxHeader.getFlags () & cProtocolHeader::FLAG_CRC32C)) &&
+        respSize >= sizeof (uint32_t);
+    // echo the timestamps of the request, if the response is large enough
+    const bool ts  = m_rxHasTimestamps &&
+        respSize >= sizeof (cProtocolTimestamps) + (crc ? sizeof (uint32_t) : 0);
+    cTxSlot& slot = nextTxSlot ();
+    slot.m_header.initResponse (seq, respSize,
+        (crc ? cProtocolHeader::FLAG_CRC32C : 0) | (ts ? cProtocolHeader::FLAG_TIMESTAMPS : 0));
+    if (ts)
+        slot.m_timestamps.init (m_rxTimestamps.getClientSend (), m_rxTime, wallClock ());
+    send (slot, respSize, false, crc, ts, dest_addr, addrlen);
 }
-void cBabblerProtocol::recvResponse (uint64_t expSeq)
+uint64_t cBabblerProtocol::recvResponse ()
 {
     bool isRequest   = false;
     uint32_t options = 0;
-    uint64_t seq = receive (isRequest, options);
+    uint64_t seq     = 0;
+    while (!receive (seq, isRequest, options))
+        ;
     if (isRequest)
         throw cProtocolException ("Unexpected packet type");
-    if (expSeq != seq)
-        throw cProtocolException ("Unexpected sequence number");
+    return seq;
 }
 void cBabblerProtocol::recvRequest (uint64_t& seq, uint32_t& expRespLen,
     struct sockaddr * src_addr, socklen_t * addrlen)
 {
     bool isRequest = true;
-    seq = receive (isRequest, expRespLen, src_addr, addrlen);
+    while (!receive (seq, isRequest, expRespLen, src_addr, addrlen))
+        ;
+    if (!isRequest)
+        throw cProtocolException ("Unexpected packet type");
+}
+bool cBabblerProtocol::tryRecvRequest (uint64_t& seq, uint32_t& expRespLen)
+{
+    bool isRequest = true;
+    if (!receive (seq, isRequest, expRespLen))
+        return false;
     if (!isRequest)
         throw cProtocolException ("Unexpected packet type");
+    return true;
+}
+bool cBabblerProtocol::tryRecvResponse (uint64_t& seq)
+{
+    bool isRequest   = false;
+    uint32_t options = 0;
+    if (!receive (seq, isRequest, options))
+        return false;
+    if (isRequest)
+        throw cProtocolException ("Unexpected packet type");
+    return true;
+}
+bool cBabblerProtocol::sendPending ()
+{
+    return m_txSent >= m_txTotal || transmit (nullptr, 0);
 }
 void cBabblerProtocol::getStats (cStats& stats)
 {
-    m_statsLock.lock ();
-    stats = m_stats;
-    m_statsLock.unlock ();
+    m_stats.read (stats);
 }
-void cBabblerProtocol::send (cProtocolHeader* h, unsigned size, int incr,
+cBabblerProtocol::cTxSlot& cBabblerProtocol::nextTxSlot ()
+{
+    // the rest of the previous message must be sent first (see sendPending)
+    BUG_ON (m_txSent < m_txTotal);
+
+    // queued and zerocopy messages still reference their slot after send
+    if (!m_zerocopy && m_batch < 2)
+        return m_txSlots[0];
+
+    cTxSlot& slot = m_txSlots[m_txSlot];
+    m_txSlot = (m_txSlot + 1) % TX_SLOTS;
+    if (slot.m_zcPending)
+    {
+        m_socket.waitZerocopy (slot.m_zcId);
+        slot.m_zcPending = false;
+    }
+    return slot;
+}
+
+void cBabblerProtocol::send (cTxSlot& slot, unsigned size, bool incr, bool crc, bool timestamps,
     const struct sockaddr *dest_addr, socklen_t addrlen)
 {
-    const unsigned totalLen = size + sizeof(cProtocolHeader);
-    uint8_t* p              = m_buf + sizeof (cProtocolHeader);
-    unsigned sent           = sizeof (cProtocolHeader);
-    uint8_t counter         = (uint8_t)h->getSequence();
+    // the payload is taken directly from the shared payload cache, only the
+    // header (timestamps and the CRC32C trailer) is written per message.
+    // Without CRC (too small for the trailer) the receiver verifies the counter
+    // pattern, whatever content was configured.
+    const unsigned extLen     = timestamps ? sizeof (slot.m_timestamps) : 0;
+    const unsigned contentLen = (crc ? size - sizeof (slot.m_trailer) : size) - extLen;
+    const uint8_t* payload    = cPayloadCache::get (crc ? m_options.m_payload : cPayloadCache::COUNTER,
+        (uint8_t)slot.m_header.getSequence(), incr, contentLen);
+    if (crc)
+    {
+        uint32_t crcValue = cCrc32c::extend (0, &slot.m_header, sizeof (slot.m_header));
+        crcValue = cCrc32c::extend (crcValue, &slot.m_timestamps, extLen);
+        slot.m_trailer = htonl (cCrc32c::extend (crcValue, payload, contentLen));
+    }
+
+    m_txMsg[0].iov_base = &slot.m_header;
+    m_txMsg[0].iov_len  = sizeof (slot.m_header);
+    m_txMsg[1].iov_base = &slot.m_timestamps;
+    m_txMsg[1].iov_len  = extLen;
+    m_txMsg[2].iov_base = const_cast<uint8_t*>(payload);
+    m_txMsg[2].iov_len  = contentLen;
+    m_txMsg[3].iov_base = &slot.m_trailer;
+    m_txMsg[3].iov_len  = size - contentLen - extLen;
+    m_txCurSlot = &slot;
+    m_txTotal   = sizeof (slot.m_header) + size;
+    m_txSent    = 0;
+    transmit (dest_addr, addrlen);
+}
+
+/*
+ * Sends (the rest of) the current message. Returns false if a non-blocking
+ * socket could not take all of it, sendPending continues where it stopped.
+ */
+bool cBabblerProtocol::transmit (const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+    struct iovec iov[4];
+    int iovcnt;
 
-    while (sent < totalLen)
+    // stream sockets get the whole message at once
+    if (m_isStream)
     {
-        for (; sent < totalLen && p < (m_buf + m_bufsize); sent++)
-            *p++ = incr ? ++counter : --counter;
+        iovcnt = sliceMessage (m_txSent, m_txTotal - m_txSent, iov);
+        const uint32_t zcId = m_socket.nextZerocopyId ();
+        uint64_t sentLen = (uint64_t)m_socket.sendv (iov, iovcnt, dest_addr, addrlen);
+        if (zcId != m_socket.nextZerocopyId ())
+        {
+            m_txCurSlot->m_zcId      = m_socket.nextZerocopyId () - 1;
+            m_txCurSlot->m_zcPending = true;
+        }
+        m_txSent += sentLen;
+        updateTransmitStats (sentLen, m_txSent < m_txTotal ? 0 : 1);
+        // the last octet of the message
+        m_txTimestampId = m_socket.nextTxTimestampId () - 1;
+        return m_txSent >= m_txTotal;
+    }
 
-        uint64_t sentLen = (uint64_t)m_socket.send (m_buf, p - m_buf, dest_addr, addrlen);
-        updateTransmitStats (sentLen, sent < totalLen ? 0 : 1);
-        p = m_buf;
+    // datagrams must fit into the receive buffer of the peer -> chunks of m_bufsize
+    while (m_txSent < m_txTotal)
+    {
+        const size_t budget = std::min (m_bufsize, m_txTotal - m_txSent);
+        iovcnt = sliceMessage (m_txSent, budget, iov);
+        if (m_batch > 1)
+        {
+            const bool whole = budget == m_txTotal;
+            m_txSent += budget;
+            queueDatagram (iov, iovcnt, m_txSent >= m_txTotal, whole, dest_addr, addrlen);
+            continue;
+        }
+        size_t sentLen = (size_t)m_socket.sendv (iov, iovcnt, dest_addr, addrlen);
+        if (!sentLen)
+            return false;
+        m_txSent += sentLen;
+        updateTransmitStats (sentLen, m_txSent < m_txTotal ? 0 : 1, 1, 1);
     }
+    // the last datagram of the message, queued ones got their id in queueDatagram
+    if (m_batch < 2)
+        m_txTimestampId = m_socket.nextTxTimestampId () - 1;
+    return true;
 }
 
-uint64_t cBabblerProtocol::receive (bool& isRequest, uint32_t& options,
-    struct sockaddr * src_addr, socklen_t * addrlen)
+// iovecs of the octets [offset, offset + len) of the current message
+int cBabblerProtocol::sliceMessage (size_t offset, size_t len, struct iovec* iov) const
 {
-    ssize_t rcvLen = m_bufContentSize;
+    int    iovcnt = 0;
+    size_t pos    = 0;
+    for (const auto& part : m_txMsg)
+    {
+        if (len && offset < pos + part.iov_len)
+        {
+            size_t skip = offset - std::min (offset, pos);
+            size_t n    = std::min (len, part.iov_len - skip);
+            iov[iovcnt].iov_base = (uint8_t*)part.iov_base + skip;
+            iov[iovcnt].iov_len  = n;
+            iovcnt++;
+            len -= n;
+        }
+        pos += part.iov_len;
+    }
+    return iovcnt;
+}
 
-    if (!rcvLen)
+void cBabblerProtocol::queueDatagram (const struct iovec* iov, int iovcnt, bool last, bool whole,
+    const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+    if (m_txQueued == m_batch)
+        flush ();
+
+    const unsigned n = m_txQueued++;
+    std::memcpy (m_txIov[n], iov, iovcnt * sizeof (*iov));
+    std::memset (&m_txMsgs[n], 0, sizeof (m_txMsgs[n]));
+    m_txMsgs[n].msg_hdr.msg_iov    = m_txIov[n];
+    m_txMsgs[n].msg_hdr.msg_iovlen = iovcnt;
+    if (dest_addr)
     {
-        // first try to at least receive the cProtocolHeader
-        rcvLen = m_socket.recv (m_buf, m_bufsize, sizeof (cProtocolHeader),
-            src_addr, addrlen);
-        m_bufContentSize = rcvLen;
-        updateReceiveStats (rcvLen, 0);
+        std::memcpy (&m_txAddr[n], dest_addr, addrlen);
+        m_txMsgs[n].msg_hdr.msg_name    = &m_txAddr[n];
+        m_txMsgs[n].msg_hdr.msg_namelen = addrlen;
     }
+    m_txLast[n]  = last;
+    m_txWhole[n] = whole;
+    // flush sends the queued datagrams in order
+    m_txTimestampId = m_socket.nextTxTimestampId () + n;
+}
 
-    // FIXME currently we can't handle fragmented headers
-    BUG_ON ((size_t)rcvLen < sizeof (cProtocolHeader));
+void cBabblerProtocol::flush ()
+{
+    if (!m_txQueued)
+        return;
 
-    // is this our cProtocolHeader?
-    cProtocolHeader* h = (cProtocolHeader*)m_pBuf;
-    if (!h->checkChecksum())
-        throw cProtocolException ("Wrong header checksum");
-    isRequest = h->isRequest();
-    if (!isRequest && !h->isResponse())
-        throw cProtocolException ("Unknown packet type");
+    // per datagram TX timestamps and launch times would get lost in a merged send
+    const bool gso = m_gso && !m_timestamping && !m_pacingRate;
+    unsigned calls = 0;
+    uint64_t sentLen = (uint64_t)(gso ? m_socket.sendmmsg (m_txGsoMsgs, mergeQueued (), &calls) :
+        m_socket.sendmmsg (m_txMsgs, m_txQueued, &calls));
+    uint64_t packets  = 0;
+    for (unsigned n = 0; n < m_txQueued; n++)
+        packets += m_txLast[n];
+    updateTransmitStats (sentLen, packets, calls, m_txQueued);
+    m_txQueued = 0;
+}
+
+/*
+ * UDP GSO: consecutive queued messages with equal size, each in one datagram
+ * of at most m_segment octets, are merged into one send with this size as
+ * segment size. So every datagram on the wire is still a complete message
+ * with its own header, a lost one doesn't affect the others.
+ * Returns the number of sends in m_txGsoMsgs.
+ */
+unsigned cBabblerProtocol::mergeQueued ()
+{
+    unsigned sends = 0;
+    unsigned iovs  = 0;
+    for (unsigned n = 0; n < m_txQueued; )
+    {
+        const size_t len = datagramSize (m_txMsgs[n].msg_hdr);
+        unsigned run = 1;
+        if (m_txWhole[n] && len <= m_segment)
+        {
+            while (n + run < m_txQueued && run < GSO_MAX_SEGMENTS && (run + 1) * len <= GSO_MAX_SIZE &&
+                m_txWhole[n + run] && datagramSize (m_txMsgs[n + run].msg_hdr) == len &&
+                sameDestination (m_txMsgs[n + run].msg_hdr, m_txMsgs[n].msg_hdr))
+                run++;
+        }
+
+        struct mmsghdr& send = m_txGsoMsgs[sends];
+        send = m_txMsgs[n];
+        if (run > 1)
+        {
+            send.msg_hdr.msg_iov    = m_txGsoIov + iovs;
+            send.msg_hdr.msg_iovlen = 0;
+            for (unsigned r = 0; r < run; r++)
+            {
+                const struct msghdr& msg = m_txMsgs[n + r].msg_hdr;
+                std::memcpy (m_txGsoIov + iovs, msg.msg_iov, msg.msg_iovlen * sizeof (*msg.msg_iov));
+                iovs += (unsigned)msg.msg_iovlen;
+                send.msg_hdr.msg_iovlen += msg.msg_iovlen;
+            }
+            cSocket::setUdpSegment (send.msg_hdr, m_txGsoControl + sends * cSocket::GSO_CONTROL_SIZE,
+                (uint16_t)len);
+        }
+        sends++;
+        n += run;
+    }
+    return sends;
+}
 
-    const uint32_t len    = h->getLength();
-    const uint64_t seq    = h->getSequence();
-    options               = h->getOptions();
-    ssize_t toBeReceived  = len - rcvLen;
-    uint8_t expPayloadVal = (uint8_t)seq;
+size_t cBabblerProtocol::datagramSize (const struct msghdr& msg)
+{
+    size_t len = 0;
+    for (size_t n = 0; n < msg.msg_iovlen; n++)
+        len += msg.msg_iov[n].iov_len;
+    return len;
+}
 
-    checkPayload (m_pBuf + sizeof (cProtocolHeader),
-                    std::min (len, (uint32_t)rcvLen) - sizeof (cProtocolHeader),
-                    isRequest, expPayloadVal);
+// servers answer several clients over the same socket
+bool cBabblerProtocol::sameDestination (const struct msghdr& a, const struct msghdr& b)
+{
+    return a.msg_namelen == b.msg_namelen &&
+        (!a.msg_namelen || !std::memcmp (a.msg_name, b.msg_name, a.msg_namelen));
+}
 
-    // receive the remaining part of the message and check the content
-    while (toBeReceived > 0)
+// batch mode: makes the next received datagram the current buffer
+bool cBabblerProtocol::nextDatagram (struct sockaddr * src_addr, socklen_t * addrlen)
+{
+    if (m_rxNext >= m_rxReceived)
     {
-        rcvLen = m_socket.recv (m_buf, std::min ((size_t)toBeReceived, m_bufsize), 0, src_addr, addrlen);
-        m_bufContentSize = rcvLen;
-        updateReceiveStats (rcvLen, 0);
-        toBeReceived -= rcvLen;
-        checkPayload (m_buf, rcvLen, isRequest, expPayloadVal);
+        // all received requests are answered, send the responses before waiting again
+        flush ();
+
+        for (unsigned n = 0; n < m_batch; n++)
+        {
+            m_rxMsgs[n].msg_hdr.msg_namelen = sizeof (m_rxAddr[n]);
+            if (m_gro || m_timestamping)
+            {
+                m_rxMsgs[n].msg_hdr.msg_control    = m_rxControl + n * cSocket::RX_CONTROL_SIZE;
+                m_rxMsgs[n].msg_hdr.msg_controllen = cSocket::RX_CONTROL_SIZE;
+            }
+        }
+        m_rxReceived = (unsigned)m_socket.recvmmsg (m_rxMsgs, m_batch);
+        m_rxNext     = 0;
+        if (!m_rxReceived)
+            return false;
+
+        uint64_t received = 0;
+        uint64_t segments = 0;
+        for (unsigned n = 0; n < m_rxReceived; n++)
+        {
+            received += m_rxMsgs[n].msg_len;
+            segments += m_gro ? cSocket::groSegments (m_rxMsgs[n].msg_hdr, m_rxMsgs[n].msg_len) : 1;
+        }
+        updateReceiveStats (received, 0, 1, segments);
     }
-    // receive buffer contains more then one message
-    if (toBeReceived < 0)
+
+    const struct mmsghdr& msg = m_rxMsgs[m_rxNext++];
+    m_pBuf           = (const uint8_t*)msg.msg_hdr.msg_iov->iov_base;
+    m_bufContentSize = msg.msg_len;
+    if (m_timestamping)
+        cSocket::rxTimestamp (msg.msg_hdr, m_rxTimestamp);
+    if (src_addr && addrlen)
     {
-        m_pBuf += len;
-        m_bufContentSize -= len;
-        BUG_ON (m_pBuf >= m_buf + m_bufsize);
+        *addrlen = std::min (*addrlen, msg.msg_hdr.msg_namelen);
+        std::memcpy (src_addr, msg.msg_hdr.msg_name, *addrlen);
     }
-    else
+    return true;
+}
+
+// returns false if a non-blocking socket had no more data before the message was complete
+bool cBabblerProtocol::receive (uint64_t& seq, bool& isRequest, uint32_t& options,
+    struct sockaddr * src_addr, socklen_t * addrlen)
+{
+    bool complete = false;
+    // stream data is parsed where io_uring has put it, the timestamp of
+    // the data is only known with recvmsg
+    const bool inPlace = m_isStream && !m_timestamping && m_socket.canRecvInPlace ();
+
+    do
     {
-        m_pBuf = m_buf;
-        m_bufContentSize = 0;
+        // the buffer may still contain (parts of) the next message
+        if (!m_bufContentSize && m_batch > 1)
+        {
+            if (!nextDatagram (src_addr, addrlen))
+                return false;
+        }
+        else if (!m_bufContentSize && inPlace)
+        {
+            m_bufContentSize = (size_t)m_socket.recvInPlace (m_pBuf, m_buf, m_bufsize);
+            updateReceiveStats (m_bufContentSize, 0, 1);
+        }
+        else if (!m_bufContentSize)
+        {
+            // scatter a new header directly into m_rxHeader, everything else goes to m_buf
+            struct iovec iov[2];
+            int iovcnt = 0;
+            size_t hdrLen = 0;
+            if (m_rxState == RX_HEADER)
+            {
+                hdrLen = sizeof (m_rxHeader) - m_rxHeaderLen;
+                iov[iovcnt].iov_base = (uint8_t*)&m_rxHeader + m_rxHeaderLen;
+                iov[iovcnt].iov_len  = hdrLen;
+                iovcnt++;
+            }
+            iov[iovcnt].iov_base = m_buf;
+            iov[iovcnt].iov_len  = m_bufsize;
+            iovcnt++;
+
+            unsigned segments = 1;
+            size_t received = (size_t)m_socket.recvv (iov, iovcnt, src_addr, addrlen,
+                m_gro ? &segments : nullptr);
+            // calls which returned nothing (non-blocking sockets) don't count
+            updateReceiveStats (received, 0, received ? 1 : 0, received ? segments : 0);
+            if (!received)
+                return false;
+            if (m_timestamping)
+                m_rxTimestamp = m_socket.getRxTimestamp ();
+            hdrLen = std::min (hdrLen, received);
+            m_rxHeaderLen   += hdrLen;
+            m_pBuf           = m_buf;
+            m_bufContentSize = received - hdrLen;
+        }
+        size_t consumed = parse (m_pBuf, m_bufContentSize, complete);
+        m_pBuf           += consumed;
+        m_bufContentSize -= consumed;
+        if (inPlace)
+            m_socket.releaseInPlace (consumed);
+    } while (!complete);
+
+    isRequest = m_rxIsRequest;
+    options   = m_rxHeader.getOptions();
+    seq       = m_rxHeader.getSequence();
+    return true;
+}
+
+/*
+ * Feeds len octets of the received byte stream into the state machine.
+ * Returns the number of consumed octets, which is less than len if data
+ * contains the beginning of the next message. In this case complete is set.
+ * Payload is verified in place, only the header is copied.
+ */
+size_t cBabblerProtocol::parse (const uint8_t* data, size_t len, bool& complete)
+{
+    size_t consumed = 0;
+    size_t n;
+    complete = false;
+
+    for (;;)
+    {
+        switch (m_rxState)
+        {
+        case RX_HEADER:
+            n = std::min (len - consumed, sizeof (m_rxHeader) - m_rxHeaderLen);
+            std::memcpy ((uint8_t*)&m_rxHeader + m_rxHeaderLen, data + consumed, n);
+            m_rxHeaderLen += n;
+            consumed      += n;
+            if (m_rxHeaderLen < sizeof (m_rxHeader))
+                return consumed;
+
+            parseHeader ();
+            m_rxState = m_rxHasTimestamps ? RX_TIMESTAMPS : RX_PAYLOAD;
+            break;
+
+        case RX_TIMESTAMPS:
+        {
+            const size_t done = m_rxOffset - sizeof (cProtocolHeader);
+            n = std::min (len - consumed, sizeof (m_rxTimestamps) - done);
+            std::memcpy ((uint8_t*)&m_rxTimestamps + done, data + consumed, n);
+            if (m_rxCrc && m_rxVerify)
+                m_rxCrcValue = cCrc32c::extend (m_rxCrcValue, data + consumed, n);
+            m_rxOffset += n;
+            consumed   += n;
+            if (done + n < sizeof (m_rxTimestamps))
+                return consumed;
+
+            m_rxState = RX_PAYLOAD;
+            break;
+        }
+
+        case RX_PAYLOAD:
+            n = std::min (len - consumed, (size_t)(m_rxContentEnd - m_rxOffset));
+            if (m_rxVerify)
+            {
+                // arbitrary content is only protected by the CRC
+                if (m_rxCrc)
+                    m_rxCrcValue = cCrc32c::extend (m_rxCrcValue, data + consumed, n);
+                else
+                    checkPayload (data + consumed, n, m_rxIsRequest, m_rxExpVal, m_rxOffset);
+            }
+            m_rxOffset += n;
+            consumed   += n;
+            if (m_rxOffset < m_rxContentEnd)
+                return consumed;
+
+            m_rxState = RX_TRAILER;
+            break;
+
+        case RX_TRAILER:
+            n = std::min (len - consumed, (size_t)(m_rxLength - m_rxOffset));
+            std::memcpy ((uint8_t*)&m_rxTrailer + (m_rxOffset - m_rxContentEnd), data + consumed, n);
+            m_rxOffset += n;
+            consumed   += n;
+            if (m_rxOffset < m_rxLength)
+                return consumed;
+
+            if (m_rxCrc && m_rxVerify && ntohl (m_rxTrailer) != m_rxCrcValue)
+                throw cProtocolException ("CRC32C mismatch");
+
+            updateReceiveStats (0, 1, 0);
+            if (m_rxVerify)
+                updateVerifyStats (m_rxLength - sizeof (cProtocolHeader), 1);
+
+            // server receive time of the request or client receive time of the response
+            if (m_rxHasTimestamps)
+                m_rxTime = wallClock ();
+
+            complete      = true;
+            m_rxState     = RX_HEADER;
+            m_rxHeaderLen = 0;
+            return consumed;
+        }
     }
-    updateReceiveStats (0, 1);
+}
 
-    return seq;
+void cBabblerProtocol::parseHeader ()
+{
+    // is this our cProtocolHeader?
+    if (m_options.m_verify != cProtocolOptions::VERIFY_NONE && !m_rxHeader.checkChecksum())
+        throw cProtocolException ("Wrong header checksum");
+    m_rxIsRequest = m_rxHeader.isRequest();
+    if (!m_rxIsRequest && !m_rxHeader.isResponse())
+        throw cProtocolException ("Unknown packet type");
+    m_rxCrc    = m_rxHeader.getFlags() & cProtocolHeader::FLAG_CRC32C;
+    m_rxHasTimestamps = m_rxHeader.getFlags() & cProtocolHeader::FLAG_TIMESTAMPS;
+    m_rxLength = m_rxHeader.getLength();
+    if (m_rxLength < sizeof (cProtocolHeader) + (m_rxCrc ? sizeof (m_rxTrailer) : 0) +
+        (m_rxHasTimestamps ? sizeof (m_rxTimestamps) : 0))
+        throw cProtocolException ("Invalid packet length");
+
+    m_rxContentEnd = m_rxCrc ? m_rxLength - sizeof (m_rxTrailer) : m_rxLength;
+    m_rxOffset     = sizeof (cProtocolHeader);
+    m_rxExpVal     = (uint8_t)m_rxHeader.getSequence();
+    m_rxVerify     = m_options.m_verify == cProtocolOptions::VERIFY_FULL ||
+        (m_options.m_verify == cProtocolOptions::VERIFY_SAMPLED &&
+         !(m_sampleCounter++ % m_options.m_verifyInterval));
+    if (m_rxCrc && m_rxVerify)
+        m_rxCrcValue = cCrc32c::extend (0, &m_rxHeader, sizeof (m_rxHeader));
 }
 
-void cBabblerProtocol::checkPayload (const uint8_t* data, unsigned len, bool incr, uint8_t& expVal) const
+// nanoseconds since the epoch, comparable between hosts (up to their clock offset)
+uint64_t cBabblerProtocol::wallClock ()
 {
-    while (len--)
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now ().time_since_epoch ()).count ();
+}
+
+void cBabblerProtocol::checkPayload (const uint8_t* data, unsigned len, bool incr, uint8_t& expVal, uint32_t offset) const
+{
+    size_t pos = cPayload::check (data, len, expVal, incr);
+    if (pos != len)
     {
-        incr ? ++expVal : --expVal;
-        if (*data++ != expVal)
-            throw cProtocolException ("Corrupted packet");
+        throw cProtocolException ("Corrupted packet at offset " + std::to_string (offset + pos));
     }
 }
 
-void cBabblerProtocol::cBabblerProtocol::updateTransmitStats (uint64_t sentOctets, uint64_t sentPackets)
+void cBabblerProtocol::updateTransmitStats (uint64_t sentOctets, uint64_t sentPackets, uint64_t sendCalls, uint64_t segments)
+{
+    m_stats.beginUpdate ();
+    m_stats.m_sentOctets   += sentOctets;
+    m_stats.m_sentPackets  += sentPackets;
+    m_stats.m_sendCalls    += sendCalls;
+    m_stats.m_sentSegments += segments;
+    if (m_zerocopy)
+    {
+        m_stats.m_zerocopySends  = (int_fast64_t)m_socket.getZerocopyCompleted ();
+        m_stats.m_zerocopyCopied = (int_fast64_t)m_socket.getZerocopyCopied ();
+    }
+    m_stats.endUpdate ();
+}
+void cBabblerProtocol::updateReceiveStats (uint64_t receivedOctets, uint64_t receivedPackets, uint64_t recvCalls, uint64_t segments)
 {
-    m_statsLock.lock ();
-    m_stats.m_sentOctets  += sentOctets;
-    m_stats.m_sentPackets += sentPackets;
-    m_statsLock.unlock ();
+    m_stats.beginUpdate ();
+    m_stats.m_receivedOctets   += receivedOctets;
+    m_stats.m_receivedPackets  += receivedPackets;
+    m_stats.m_recvCalls        += recvCalls;
+    m_stats.m_receivedSegments += segments;
+    m_stats.endUpdate ();
 }
-void cBabblerProtocol::updateReceiveStats (uint64_t receivedOctets, uint64_t receivedPackets)
+void cBabblerProtocol::updateVerifyStats (uint64_t verifiedOctets, uint64_t verifiedPackets)
 {
-    m_statsLock.lock ();
-    m_stats.m_receivedOctets  += receivedOctets;
-    m_stats.m_receivedPackets += receivedPackets;
-    m_statsLock.unlock ();
+    m_stats.beginUpdate ();
+    m_stats.m_verifiedOctets  += verifiedOctets;
+    m_stats.m_verifiedPackets += verifiedPackets;
+    m_stats.endUpdate ();
 }
@@ -24,10 +24,12 @@
 #include <cinttypes>
 #include <stdexcept>
 #include <mutex>
+#include <string>
 
 #include "bug.hpp"
 #include "socket.hpp"
 #include "stats.hpp"
+#include "protocoloptions.hpp"
 
 
 class cProtocolException : public std::runtime_error
@@ -36,13 +38,27 @@ public:
     cProtocolException (const char* what) : std::runtime_error (what)
     {
     }
+    cProtocolException (const std::string& what) : std::runtime_error (what)
+    {
+    }
 };
 
+/*
+ * type: 0xaa (request) or 0xee (response), 16 bit flags, 0xee (request) or 0xaa (response)
+ * The flags are transmitted inverted, so messages without flags have the
+ * original types 0xaaffffee and 0xeeffffaa.
+ */
 struct cProtocolHeader
 {
-    void initRequest(uint64_t sequence, uint32_t payloadLength, uint32_t respLength)
+    enum : uint16_t
     {
-        type     = htonl (0xaaffffee);
+        FLAG_CRC32C     = 0x0001, // last 4 payload bytes are a CRC32C over header and payload
+        FLAG_TIMESTAMPS = 0x0002  // header is followed by cProtocolTimestamps
+    };
+
+    void initRequest(uint64_t sequence, uint32_t payloadLength, uint32_t respLength, uint16_t flags = 0)
+    {
+        type     = htonl (0xaa0000ee | ((uint32_t)(uint16_t)~flags << 8));
         length   = htonl (payloadLength + sizeof (*this));
         seq      = htobe64 (sequence);
         options  = htonl (respLength);
@@ -50,11 +66,11 @@ struct cProtocolHeader
     }
     bool isRequest ()
     {
-        return type == htonl(0xaaffffee);
+        return (ntohl (type) & 0xff0000ff) == 0xaa0000ee;
     }
-    void initResponse (uint64_t sequence, uint32_t payloadLength)
+    void initResponse (uint64_t sequence, uint32_t payloadLength, uint16_t flags = 0)
     {
-        type     = htonl (0xeeffffaa);
+        type     = htonl (0xee0000aa | ((uint32_t)(uint16_t)~flags << 8));
         length   = htonl (payloadLength + sizeof (*this));
         seq      = htobe64 (sequence);
         options  = 0;
@@ -62,7 +78,11 @@ struct cProtocolHeader
     }
     bool isResponse ()
     {
-        return type == htonl(0xeeffffaa);
+        return (ntohl (type) & 0xff0000ff) == 0xee0000aa;
+    }
+    uint16_t getFlags ()
+    {
+        return (uint16_t)~(ntohl (type) >> 8);
     }
 
     uint32_t calcChecksum ()
@@ -103,10 +123,43 @@ private:
 //    uint8_t data[];
 };
 
+/*
+ * Header extension of messages with FLAG_TIMESTAMPS, nanoseconds of the
+ * wall clock (CLOCK_REALTIME) of the respective host.
+ * Requests carry only clientSend, the response echoes it and adds the time
+ * the server received the request and sent the response.
+ */
+struct cProtocolTimestamps
+{
+    void init (uint64_t clientSendTime, uint64_t serverRecvTime = 0, uint64_t serverSendTime = 0)
+    {
+        clientSend = htobe64 (clientSendTime);
+        serverRecv = htobe64 (serverRecvTime);
+        serverSend = htobe64 (serverSendTime);
+    }
+    uint64_t getClientSend () const
+    {
+        return be64toh (clientSend);
+    }
+    uint64_t getServerRecv () const
+    {
+        return be64toh (serverRecv);
+    }
+    uint64_t getServerSend () const
+    {
+        return be64toh (serverSend);
+    }
+
+private:
+    uint64_t clientSend;
+    uint64_t serverRecv;
+    uint64_t serverSend;
+};
+
 class cBabblerProtocol
 {
 protected:
-    cBabblerProtocol (cSocket& sock, unsigned bufsize);
+    cBabblerProtocol (cSocket& sock, unsigned bufsize, const cProtocolOptions& options);
 
 public:
     // no default/copy/move constructor and copy/move operator
@@ -121,41 +174,201 @@ public:
     void sendRequest (uint64_t seq, unsigned reqSize, unsigned respSize);
     void sendResponse (uint64_t seq, unsigned respSize,
         const struct sockaddr *dest_addr = nullptr, socklen_t addrlen = 0);
-    void recvResponse (uint64_t expSeq);
+    uint64_t recvResponse ();
     void recvRequest (uint64_t& seq, uint32_t& expRespLen,
         struct sockaddr * src_addr = nullptr, socklen_t * addrlen = nullptr);
+    // non-blocking sockets: return false if no complete message has been received yet
+    bool tryRecvRequest (uint64_t& seq, uint32_t& expRespLen);
+    bool tryRecvResponse (uint64_t& seq);
+    // non-blocking sockets: sends the rest of a partially sent message,
+    // returns false if the socket still can't take all of it
+    bool sendPending ();
     void getStats (cStats& stats);
+    // send queued datagrams (batch mode)
+    void flush ();
     const unsigned MIN_LEN = 32;
 
 private:
-    void send (cProtocolHeader* h, unsigned size, int incr,
+    struct cTxSlot;
+    cTxSlot& nextTxSlot ();
+    void send (cTxSlot& slot, unsigned size, bool incr, bool crc, bool timestamps,
         const struct sockaddr *dest_addr = nullptr, socklen_t addrlen = 0);
+    bool transmit (const struct sockaddr *dest_addr, socklen_t addrlen);
+    int sliceMessage (size_t offset, size_t len, struct iovec* iov) const;
+    void queueDatagram (const struct iovec* iov, int iovcnt, bool last, bool whole,
+        const struct sockaddr *dest_addr, socklen_t addrlen);
+    unsigned mergeQueued ();
+    static size_t datagramSize (const struct msghdr& msg);
+    static bool sameDestination (const struct msghdr& a, const struct msghdr& b);
+    bool nextDatagram (struct sockaddr * src_addr, socklen_t * addrlen);
 
-    uint64_t receive (bool& isRequest, uint32_t& options,
+    bool receive (uint64_t& seq, bool& isRequest, uint32_t& options,
         struct sockaddr * src_addr = nullptr, socklen_t * addrlen = nullptr);
+    size_t parse (const uint8_t* data, size_t len, bool& complete);
+    void parseHeader ();
 
-    void checkPayload (const uint8_t* data, unsigned len, bool incr, uint8_t& expVal) const;
-    void updateTransmitStats (uint64_t sentOctets, uint64_t sentPackets);
-    void updateReceiveStats (uint64_t receivedOctets, uint64_t receivedPackets);
+    void checkPayload (const uint8_t* data, unsigned len, bool incr, uint8_t& expVal, uint32_t offset) const;
+    void updateTransmitStats (uint64_t sentOctets, uint64_t sentPackets, uint64_t sendCalls = 1, uint64_t segments = 1);
+    void updateReceiveStats (uint64_t receivedOctets, uint64_t receivedPackets, uint64_t recvCalls, uint64_t segments = 0);
+    void updateVerifyStats (uint64_t verifiedOctets, uint64_t verifiedPackets);
 
 protected:
+    const cProtocolOptions& getOptions () const
+    {
+        return m_options;
+    }
     int_fast64_t getSentOctets () const
     {
-        return m_stats.m_sentOctets;
+        return m_stats.m_sentOctets.get ();
     }
     int_fast64_t getReceivedOctets () const
     {
-        return m_stats.m_receivedOctets;
+        return m_stats.m_receivedOctets.get ();
+    }
+    bool isNonBlocking () const
+    {
+        return m_socket.isNonBlocking ();
+    }
+    // see cSocket::setPacingRate
+    bool setPacingRate (uint64_t bytesPerSecond)
+    {
+        if (!m_socket.setPacingRate (bytesPerSecond))
+            return false;
+        m_pacingRate = bytesPerSecond;
+        return true;
+    }
+    // 0 if not paced. Doesn't need the socket, which may be closed already.
+    uint64_t getPacingRate () const
+    {
+        return m_pacingRate;
+    }
+    // kernel timestamps, see cSocket::enableTimestamping
+    bool enableTimestamping (bool hardware)
+    {
+        return m_timestamping = m_socket.enableTimestamping (hardware);
+    }
+    bool isTimestamping () const
+    {
+        return m_timestamping;
+    }
+    // TX timestamp id of the last sent message and its timestamp
+    uint32_t getTxTimestampId () const
+    {
+        return m_txTimestampId;
+    }
+    bool getTxTimestamp (uint32_t id, cSocket::timestamp& ts)
+    {
+        return m_socket.getTxTimestamp (id, ts);
     }
+    // RX timestamp of the last received message
+    const cSocket::timestamp& getRxTimestamp () const
+    {
+        return m_rxTimestamp;
+    }
+    // header timestamps of the last received message, nullptr if it had none
+    const cProtocolTimestamps* getRxHeaderTimestamps () const
+    {
+        return m_rxHasTimestamps ? &m_rxTimestamps : nullptr;
+    }
+    // wall clock when the last message with header timestamps was complete
+    uint64_t getRxTime () const
+    {
+        return m_rxTime;
+    }
+    static uint64_t wallClock ();
 
 private:
     cSocket& m_socket;
     const size_t m_bufsize;
+    bool m_isStream;
+    // datagram sockets: queued messages of up to m_segment octets (a datagram each)
+    // with equal size are passed to the kernel at once (UDP GSO), see flush
+    size_t m_segment;
+    bool   m_gso;
+    // the kernel limits a GSO send to 64 segments and the maximum IP packet size
+    static const unsigned GSO_MAX_SEGMENTS = 64;
+    static const size_t   GSO_MAX_SIZE     = 65000;
+    bool   m_gro;
+    const cProtocolOptions m_options;
+    uint64_t m_sampleCounter;
     size_t m_bufContentSize;
+    size_t m_bufAllocSize;
     uint8_t* m_buf;
-    uint8_t* m_pBuf;
-    cStats m_stats;
-    std::mutex m_statsLock;
+    const uint8_t* m_pBuf;  // unparsed data in m_buf or in the io_uring buffer ring
+    bool m_zerocopy;
+    bool m_timestamping;
+    uint64_t m_pacingRate;  // bytes per second
+    uint32_t m_txTimestampId;
+    cSocket::timestamp m_rxTimestamp; // of the last receive call or datagram
+
+    // per message data which is sent along with the shared payload.
+    // With zerocopy the kernel still references the slot after sending, so
+    // it can only be reused after the completion notification.
+    struct cTxSlot
+    {
+        cProtocolHeader m_header;
+        cProtocolTimestamps m_timestamps;
+        uint32_t m_trailer;   // CRC32C
+        uint32_t m_zcId;      // last zerocopy send referencing this slot
+        bool     m_zcPending;
+    };
+    static const unsigned TX_SLOTS = 64;
+    static_assert (TX_SLOTS >= cProtocolOptions::MAX_BATCH, "every queued message needs its own slot");
+    cTxSlot  m_txSlots[TX_SLOTS];
+    unsigned m_txSlot;
+
+    // message currently sent, non-blocking sockets may leave a rest of it
+    cTxSlot* m_txCurSlot;
+    struct iovec m_txMsg[4]; // header, timestamps, payload, trailer
+    size_t   m_txTotal;
+    size_t   m_txSent;
+
+    // batch mode (datagram sockets only): up to m_batch datagrams per
+    // recvmmsg/sendmmsg. Queued datagrams are sent before the next receive.
+    // Only allocated in batch mode, a server may have lots of connections.
+    unsigned m_batch;
+    struct mmsghdr*   m_txMsgs;
+    struct iovec    (*m_txIov)[4];
+    sockaddr_storage* m_txAddr;
+    bool*             m_txLast;  // last datagram of a message
+    bool*             m_txWhole; // the datagram is a complete message
+    // UDP GSO: the queued datagrams, runs of messages with equal size merged
+    struct mmsghdr*   m_txGsoMsgs;
+    struct iovec*     m_txGsoIov;
+    uint8_t*          m_txGsoControl;
+    unsigned          m_txQueued;
+    struct mmsghdr*   m_rxMsgs;
+    struct iovec*     m_rxIov;
+    sockaddr_storage* m_rxAddr;
+    uint8_t*          m_rxControl;
+    unsigned          m_rxReceived; // datagrams of the last recvmmsg
+    unsigned          m_rxNext;     // next one to be parsed
+
+    // receive state machine, works on any chunking of the received byte stream
+    enum rxState_t
+    {
+        RX_HEADER,     // (partial) header
+        RX_TIMESTAMPS, // (partial) header extension
+        RX_PAYLOAD,    // header complete, waiting for the rest of the payload
+        RX_TRAILER     // (partial) CRC32C trailer
+    };
+    rxState_t m_rxState;
+    cProtocolHeader m_rxHeader;
+    size_t   m_rxHeaderLen;     // received octets of m_rxHeader
+    uint32_t m_rxLength;        // length of the current message
+    uint32_t m_rxContentEnd;    // offset of the trailer, m_rxLength if there is none
+    uint32_t m_rxOffset;        // offset of the next octet within the current message
+    uint8_t  m_rxExpVal;        // last verified payload value
+    bool     m_rxIsRequest;
+    bool     m_rxVerify;        // verify payload of the current message
+    bool     m_rxCrc;           // current message has a CRC32C trailer
+    uint32_t m_rxCrcValue;      // CRC32C of the received part of the message
+    uint32_t m_rxTrailer;
+    bool     m_rxHasTimestamps; // current message has cProtocolTimestamps
+    cProtocolTimestamps m_rxTimestamps;
+    uint64_t m_rxTime;
+
+    cSharedStats m_stats;
 };
 
 #endif
\ No newline at end of file
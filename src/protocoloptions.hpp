@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROTOCOLOPTIONS_HPP
+#define PROTOCOLOPTIONS_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cctype>
+#include <climits>
+
+#include "payload.hpp"
+
+// options of cBabblerProtocol, which are common for client and server
+class cProtocolOptions
+{
+public:
+    enum verify_t
+    {
+        VERIFY_FULL,    // header and payload of every message
+        VERIFY_SAMPLED, // header of every message, payload of every Nth message
+        VERIFY_HEADER,  // header checksum and sequence number only
+        VERIFY_NONE     // nothing, just parse the messages
+    };
+    enum timestamps_t
+    {
+        TIMESTAMPS_OFF,
+        TIMESTAMPS_SOFTWARE, // kernel timestamps (SO_TIMESTAMPING)
+        TIMESTAMPS_HARDWARE  // ... and NIC timestamps, if available
+    };
+
+    cProtocolOptions () :
+        m_verify (VERIFY_FULL),
+        m_verifyInterval (1),
+        m_crc32c (false),
+        m_payload (cPayloadCache::COUNTER),
+        m_zerocopy (false),
+        m_batch (1),
+        m_udpSegment (0),
+        m_numaLocal (false),
+        m_timestamps (TIMESTAMPS_OFF),
+        m_headerTimestamps (false),
+        m_pacingRate (0)
+    {
+    }
+
+    // full | sampled[:N] | header | none
+    void setVerify (const std::string& s)
+    {
+        m_verifyInterval = 1;
+        if (s == "full")
+            m_verify = VERIFY_FULL;
+        else if (s == "header")
+            m_verify = VERIFY_HEADER;
+        else if (s == "none")
+            m_verify = VERIFY_NONE;
+        else if (s.compare (0, 7, "sampled") == 0)
+        {
+            m_verify = VERIFY_SAMPLED;
+            m_verifyInterval = 16;
+            if (s.size () > 7)
+            {
+                if (s[7] != ':')
+                    throw std::invalid_argument (s);
+                // stoul skips white space, accepts a sign and ignores trailing garbage
+                const std::string n = s.substr (8);
+                size_t pos = 0;
+                unsigned long interval = 0;
+                try
+                {
+                    if (!n.empty () && std::isdigit ((unsigned char)n[0]))
+                        interval = std::stoul (n, &pos);
+                }
+                catch (const std::out_of_range&)
+                {
+                }
+                if (!interval || pos != n.size () || interval > UINT_MAX)
+                    throw std::invalid_argument (s);
+                m_verifyInterval = (unsigned)interval;
+            }
+        }
+        else
+            throw std::invalid_argument (s);
+    }
+
+    // counter | zero | random
+    void setPayload (const std::string& s)
+    {
+        if (s == "counter")
+            m_payload = cPayloadCache::COUNTER;
+        else if (s == "zero")
+            m_payload = cPayloadCache::ZERO;
+        else if (s == "random")
+            m_payload = cPayloadCache::RANDOM;
+        else
+            throw std::invalid_argument (s);
+    }
+
+    // sw | hw
+    void setTimestamps (const std::string& s)
+    {
+        if (s == "sw")
+            m_timestamps = TIMESTAMPS_SOFTWARE;
+        else if (s == "hw")
+            m_timestamps = TIMESTAMPS_HARDWARE;
+        else
+            throw std::invalid_argument (s);
+    }
+
+    // only the counter pattern can be verified without checksum
+    bool useCrc32c () const
+    {
+        return m_crc32c || m_payload != cPayloadCache::COUNTER;
+    }
+
+    verify_t m_verify;
+    unsigned m_verifyInterval; // sampled: payload of every Nth message is verified
+    bool     m_crc32c;         // append CRC32C over header and payload to sent messages
+    cPayloadCache::content_t m_payload;
+    bool     m_zerocopy;       // send large messages with MSG_ZEROCOPY (stream sockets only)
+    unsigned m_batch;          // datagrams per recvmmsg/sendmmsg (datagram sockets only)
+    unsigned m_udpSegment;     // datagram size with UDP GSO/GRO, 0: off
+    bool     m_numaLocal;      // buffers on the NUMA node of the (pinned) thread
+    timestamps_t m_timestamps; // clients only: kernel round trip times
+    bool     m_headerTimestamps; // clients only: requests with cProtocolTimestamps (one-way delays)
+    uint64_t m_pacingRate;     // clients only: octets per second paced by the kernel, 0: off
+
+    static const unsigned MAX_BATCH = 64;
+};
+
+#endif
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "reactor.hpp"
+#include "responder.hpp"
+#include "console.hpp"
+
+
+struct cReactor::cConnection
+{
+    cConnection (cSocket s, unsigned socketBufSize, const cProtocolOptions& options, const char* proto)
+        : m_socket (nonBlocking (std::move (s))),
+          m_responder (m_socket, socketBufSize, options),
+          m_proto (proto),
+          m_events (0),
+          m_queued (false),
+          m_closed (false)
+    {
+    }
+    // before the responder is created, which depends on it (e.g. zerocopy)
+    static cSocket nonBlocking (cSocket s)
+    {
+        s.setNonBlocking ();
+        return s;
+    }
+
+    cSocket     m_socket;
+    cResponder  m_responder;
+    const char* m_proto;
+    uint32_t    m_events;  // watched epoll events, 0 if not yet registered
+    bool        m_queued;  // in m_ready of its loop
+    bool        m_closed;
+};
+
+
+cReactor::cReactor (unsigned threads, const cAffinity* affinity, bool sharded)
+{
+    if (!threads)
+    {
+        long numberOfCPUs = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = numberOfCPUs > 0 ? (unsigned)numberOfCPUs : 1;
+    }
+
+    // every connection needs a file descriptor, the default soft limit is far too low
+    struct rlimit limit;
+    if (!getrlimit (RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit (RLIMIT_NOFILE, &limit);
+    }
+
+    for (unsigned n = 0; n < threads; n++)
+        m_loops.push_back (new cLoop (!affinity ? -1 : sharded ? affinity->shardCpu (n) : affinity->cpu (n)));
+}
+
+cReactor::~cReactor ()
+{
+    for (auto loop : m_loops)
+        delete loop;
+}
+
+void cReactor::add (cSocket s, unsigned socketBufSize, const cProtocolOptions& options, const char* proto,
+    int loop)
+{
+    cLoop* target = loop >= 0 ? m_loops[(unsigned)loop % m_loops.size ()] :
+        *std::min_element (m_loops.begin (), m_loops.end (),
+            [](const cLoop* a, const cLoop* b) {return a->connections () < b->connections ();});
+    target->add (cPending {std::move (s), socketBufSize, options, proto});
+}
+
+
+cReactor::cLoop::cLoop (int cpu)
+    : m_epfd (-1), m_cpu (cpu), m_terminate (false), m_connections (0)
+{
+    m_epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (m_epfd < 0)
+        throw cSocket::errorException (errno);
+
+    // the wakeup event is the only one without connection
+    struct epoll_event ev;
+    std::memset (&ev, 0, sizeof (ev));
+    ev.events   = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl (m_epfd, EPOLL_CTL_ADD, m_wakeup, &ev))
+    {
+        int err = errno;
+        ::close (m_epfd);
+        throw cSocket::errorException (err);
+    }
+
+    m_thread = std::thread (&cLoop::threadFunc, this);
+}
+
+cReactor::cLoop::~cLoop ()
+{
+    terminate ();
+    m_thread.join ();
+
+    for (auto conn : m_active)
+        delete conn;
+    ::close (m_epfd);
+}
+
+void cReactor::cLoop::add (cPending&& conn)
+{
+    m_connections++;
+    m_lock.lock ();
+    m_new.push_back (std::move (conn));
+    m_lock.unlock ();
+    m_wakeup.send ();
+}
+
+void cReactor::cLoop::terminate ()
+{
+    m_terminate = true;
+    m_wakeup.send ();
+}
+
+void cReactor::cLoop::threadFunc ()
+{
+    Console::PrintDebug ("reactor thread started\n");
+    if (!cAffinity::pin (m_cpu))
+        Console::PrintError ("Could not pin reactor thread to CPU %d\n", m_cpu);
+
+    const int MAX_EVENTS = 256;
+    struct epoll_event events[MAX_EVENTS];
+    while (!m_terminate)
+    {
+        // connections with already received requests must not wait for new data
+        int ret = epoll_wait (m_epfd, events, MAX_EVENTS, m_ready.empty () ? -1 : 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            Console::PrintError ("%s\n", cSocket::errorException (errno).what ());
+            break;
+        }
+
+        std::deque<cConnection*> ready;
+        ready.swap (m_ready);
+        for (auto conn : ready)
+            conn->m_queued = false;
+
+        for (int n = 0; n < ret; n++)
+        {
+            cConnection* conn = reinterpret_cast<cConnection*>(events[n].data.ptr);
+            if (conn)
+                serve (conn);
+            else
+                takeNewConnections ();
+        }
+        for (auto conn : ready)
+            serve (conn);
+
+        // only now nobody references them any more
+        for (auto conn : m_closed)
+            delete conn;
+        m_closed.clear ();
+    }
+
+    Console::PrintDebug ("reactor thread terminated\n");
+}
+
+void cReactor::cLoop::takeNewConnections ()
+{
+    m_wakeup.wait ();
+
+    std::deque<cPending> added;
+    m_lock.lock ();
+    added.swap (m_new);
+    m_lock.unlock ();
+
+    // created here, so that the buffers are allocated by the thread using them
+    // (NUMA locality). The first serve also registers the connection.
+    for (auto& pending : added)
+    {
+        cConnection* conn = nullptr;
+        try
+        {
+            conn = new cConnection (std::move (pending.m_socket), pending.m_socketBufSize,
+                pending.m_options, pending.m_proto);
+        }
+        catch (const cSocket::errorException& e)
+        {
+            // only this connection is lost
+            Console::PrintError ("%s\n", e.what());
+            m_connections--;
+            continue;
+        }
+        m_active.insert (conn);
+        serve (conn);
+    }
+}
+
+void cReactor::cLoop::serve (cConnection* conn)
+{
+    // requests per round, so that a busy connection can't starve the others
+    const unsigned BUDGET = 64;
+
+    if (conn->m_closed)
+        return;
+    try
+    {
+        cResponder::state_t state = conn->m_responder.serve (BUDGET);
+        watch (conn, state == cResponder::WANT_WRITE ? EPOLLOUT : EPOLLIN);
+        if (state == cResponder::BUSY && !conn->m_queued)
+        {
+            conn->m_queued = true;
+            m_ready.push_back (conn);
+        }
+    }
+    catch (const cSocket::errorException& e)
+    {
+        Console::PrintError ("%s\n", e.what());
+        close (conn);
+    }
+    catch (const cProtocolException& e)
+    {
+        Console::PrintError ("%s\n", e.what());
+        close (conn);
+    }
+}
+
+void cReactor::cLoop::watch (cConnection* conn, uint32_t events)
+{
+    if (conn->m_events == events)
+        return;
+
+    // level triggered, so a partially read request is reported again
+    struct epoll_event ev;
+    std::memset (&ev, 0, sizeof (ev));
+    ev.events   = events;
+    ev.data.ptr = conn;
+    if (epoll_ctl (m_epfd, conn->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->m_socket.nativeHandle (), &ev))
+        throw cSocket::errorException (errno);
+    conn->m_events = events;
+}
+
+void cReactor::cLoop::close (cConnection* conn)
+{
+    Console::PrintDebug ("%s connection closed\n", conn->m_proto);
+
+    if (conn->m_events)
+        epoll_ctl (m_epfd, EPOLL_CTL_DEL, conn->m_socket.nativeHandle (), nullptr);
+    if (conn->m_queued)
+        m_ready.erase (std::find (m_ready.begin (), m_ready.end (), conn));
+    conn->m_closed = true;
+    m_active.erase (conn);
+    m_closed.push_back (conn);
+    m_connections--;
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+
+#include "socket.hpp"
+#include "event.hpp"
+#include "protocoloptions.hpp"
+#include "affinity.hpp"
+
+
+/**
+ * Serves connections of stream protocols with a fixed number of event loops
+ * instead of one thread per connection.
+ *
+ * Each loop is a thread waiting with epoll on all of its (non-blocking)
+ * connections. A new connection is handed over to the loop with the least
+ * connections and stays there until it is closed.
+ */
+class cReactor
+{
+public:
+    cReactor (const cReactor&) = delete;
+    cReactor& operator=(const cReactor&) = delete;
+
+    // threads == 0: one event loop per CPU, loop n is pinned to affinity->cpu (n)
+    // sharded: loop n is pinned to affinity->shardCpu (n), i.e. always pinned
+    explicit cReactor (unsigned threads = 0, const cAffinity* affinity = nullptr, bool sharded = false);
+    ~cReactor ();
+
+    // loop < 0: the loop with the least connections
+    void add (cSocket s, unsigned socketBufSize, const cProtocolOptions& options, const char* proto,
+        int loop = -1);
+    unsigned threads () const {return (unsigned)m_loops.size ();}
+
+private:
+    struct cConnection;
+    // accepted connection, not yet owned by its loop
+    struct cPending
+    {
+        cSocket     m_socket;
+        unsigned    m_socketBufSize;
+        cProtocolOptions m_options;
+        const char* m_proto;
+    };
+
+    class cLoop
+    {
+    public:
+        explicit cLoop (int cpu);
+        ~cLoop ();
+        void add (cPending&& conn);
+        void terminate ();
+        unsigned connections () const {return m_connections;}
+
+    private:
+        void threadFunc ();
+        void takeNewConnections ();
+        void serve (cConnection* conn);
+        void close (cConnection* conn);
+        void watch (cConnection* conn, uint32_t events);
+
+        int                   m_epfd;
+        int                   m_cpu;
+        cEvent                m_wakeup;
+        std::atomic<bool>     m_terminate;
+        std::atomic<unsigned> m_connections;
+        std::mutex            m_lock;       // protects m_new
+        std::deque<cPending>  m_new;        // added, not yet watched
+        std::unordered_set<cConnection*> m_active;
+        std::deque<cConnection*> m_ready;   // budget exhausted, serve again without waiting
+        std::vector<cConnection*> m_closed; // deleted after the current round
+        std::thread           m_thread;
+    };
+
+    std::vector<cLoop*> m_loops;
+};
+
+#endif
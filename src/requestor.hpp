@@ -20,26 +20,88 @@
 #define REQUESTOR_HPP
 
 #include <random>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <atomic>
+#include <algorithm>
 
 #include "protocol.hpp"
+#include "console.hpp"
+#include "tokenbucket.hpp"
 
 class cRequestor : public cBabblerProtocol
 {
 public:
-    cRequestor (cSocket& sock, unsigned bufsize, const cComSettings comSettings, uint64_t delay, int_fast64_t sendLimit, int_fast64_t recvLimit)
-        : cBabblerProtocol (sock, bufsize),
+    cRequestor (cSocket& sock, unsigned bufsize, const cProtocolOptions& options, const cComSettings comSettings,
+        uint64_t delay, unsigned count, unsigned window, int_fast64_t sendLimit, int_fast64_t recvLimit,
+        double rate = 0, bool poisson = false, cTokenBucket* byteLimit = nullptr, cTokenBucket* requestLimit = nullptr)
+        : cBabblerProtocol (sock, bufsize, options),
           m_comSettings (comSettings),
           m_currReqSize (m_comSettings.m_requestSizeMin),
           m_currRespSize (m_comSettings.m_responseSizeMin),
           m_reqDelta (0, m_comSettings.m_requestSizeMax - m_comSettings.m_requestSizeMin),
           m_respDelta (0, m_comSettings.m_responseSizeMax - m_comSettings.m_responseSizeMin),
           m_delay (delay),
+          m_count (count),
+          m_window (window ? window : 1),
+          m_rate (rate),
+          m_poisson (poisson),
+          m_arrivals (rate > 0 ? rate : 1.0),
+          m_arrivalRng (poisson ? std::random_device () () : 0),
+          m_byteLimit (byteLimit),
+          m_requestLimit (requestLimit),
+          m_tokensTaken (false),
           m_sendLimitOctets(sendLimit),
           m_recvLimitOctets(recvLimit),
           m_seq (0),
-          m_wantStatus (m_delay > 10000)
+          m_pendingRespOctets (0),
+          m_sendDone (false),
+          m_wantStatus (m_delay > 10000),
+          m_txIncompleteSeq (0),
+          m_clockOffset (0),
+          m_clockOffsetDelay (0),
+          m_offsetSamples (0),
+          m_offsetValid (false),
+          m_bestOffset (0),
+          m_bestDelay (0)
     {
+        if (options.m_timestamps != cProtocolOptions::TIMESTAMPS_OFF)
+        {
+            if (enableTimestamping (options.m_timestamps == cProtocolOptions::TIMESTAMPS_HARDWARE))
+            {
+                m_kernelLatency.reset (new cSharedLatencyHistogram);
+                m_nicLatency.reset (new cSharedLatencyHistogram);
+                m_hostLatency.reset (new cSharedLatencyHistogram);
+            }
+            else
+                Console::PrintError ("Kernel timestamps are not supported\n");
+        }
+        if (options.m_pacingRate && !setPacingRate (options.m_pacingRate))
+            Console::PrintError ("Kernel pacing is not supported\n");
+        if (m_rate > 0)
+        {
+            m_sendLag.reset (new cSharedLatencyHistogram);
+            m_nextSend = std::chrono::steady_clock::now ();
+        }
+        if (options.m_headerTimestamps)
+        {
+            m_requestPath.reset (new cSharedLatencyHistogram);
+            m_serverTime.reset (new cSharedLatencyHistogram);
+            m_responsePath.reset (new cSharedLatencyHistogram);
+        }
     }
+
+    enum state_t
+    {
+        WANT_READ,  // waiting for a response
+        WANT_WRITE, // a request could not be sent completely
+        WANT_TIMER, // interval, nothing to do before getNotBefore ()
+        WANT_READ_OR_TIMER, // open loop: waiting for a response and the next send time (getNotBefore ())
+        BUSY,       // budget exhausted
+        DONE        // count or limits reached, all responses received
+    };
     bool isLimitReached (int_fast64_t limit, int_fast64_t sentRecvOctetts, unsigned& toBeSentReceived) const
     {
         if (limit > 0)
@@ -57,28 +119,315 @@ public:
         }
         return false;
     }
+
+    // sends requests until the window is full and waits for one response
     void doJob ()
     {
-        if (isLimitReached (m_sendLimitOctets, getSentOctets(), m_currReqSize) ||
-            isLimitReached (m_recvLimitOctets, getReceivedOctets(), m_currRespSize))
+        send_t sent;
+        while ((sent = sendNext ()) != SENT_NOTHING && sent != SENT_LATER)
+        {
+            if (sent == SENT_ONE_WAY)
+                return;
+        }
+
+        if (m_pending.empty ())
+        {
+            flush ();
+            if (sent != SENT_LATER)
+                throw cSocket::eventException ();
+            // blocking sockets can't wait for the schedule and for responses at the same time,
+            // late requests show up as lag
+            std::this_thread::sleep_until (m_notBefore);
+            return;
+        }
+
+        uint64_t seq = recvResponse ();
+        received (seq);
+    }
+
+    // non-blocking sockets: sends requests and processes responses like doJob,
+    // but returns instead of waiting. Up to budget messages per call.
+    state_t serve (unsigned budget)
+    {
+        for (unsigned n = 0; n < budget; n++)
+        {
+            uint64_t seq;
+            if (!sendPending ())
+            {
+                m_txIncompleteSeq = m_seq;
+                // the peer might wait until we take its responses
+                if (m_pending.empty () || !tryRecvResponse (seq))
+                    return WANT_WRITE;
+                received (seq);
+                continue;
+            }
+            if (m_txIncompleteSeq)
+                txCompleted ();
+            if (m_delay && std::chrono::steady_clock::now () < m_notBefore)
+                return WANT_TIMER;
+            const send_t sent = sendNext ();
+            if (sent == SENT_REQUEST || sent == SENT_ONE_WAY)
+                continue;
+
+            if (m_pending.empty ())
+            {
+                flush ();
+                return sent == SENT_LATER ? WANT_TIMER : DONE;
+            }
+            if (!tryRecvResponse (seq))
+                return sent == SENT_LATER ? WANT_READ_OR_TIMER : WANT_READ;
+            received (seq);
+        }
+        return BUSY;
+    }
+    std::chrono::steady_clock::time_point getNotBefore () const
+    {
+        return m_notBefore;
+    }
+
+    void getStats (cStats& stats)
+    {
+        cBabblerProtocol::getStats (stats);
+        stats.m_pacingRate = (int_fast64_t)getPacingRate ();
+        m_latency.read (stats.m_latency);
+        if (isTimestamping ())
         {
-            throw cSocket::eventException ();
+            m_kernelLatency->read (stats.m_kernelLatency);
+            m_nicLatency->read (stats.m_nicLatency);
+            m_hostLatency->read (stats.m_hostLatency);
         }
+        if (m_sendLag)
+            m_sendLag->read (stats.m_sendLag);
+        if (m_requestPath)
+        {
+            m_requestPath->read (stats.m_requestPath);
+            m_serverTime->read (stats.m_serverTime);
+            m_responsePath->read (stats.m_responsePath);
+            stats.m_clockOffset      = m_clockOffset.load (std::memory_order_relaxed);
+            stats.m_clockOffsetDelay = m_clockOffsetDelay.load (std::memory_order_relaxed);
+        }
+    }
 
-        auto start = std::chrono::high_resolution_clock::now();
-        sendRequest (++m_seq, m_currReqSize, m_currRespSize);
-        if (m_currRespSize)
-            recvResponse (m_seq);
-        auto end = std::chrono::high_resolution_clock::now();
+private:
+    struct cRequest
+    {
+        uint64_t m_seq;
+        unsigned m_reqSize;
+        unsigned m_respSize;
+        uint32_t m_txId;   // kernel TX timestamp
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    enum send_t
+    {
+        SENT_NOTHING, // window full or count/limits reached
+        SENT_LATER,   // open loop: not before getNotBefore ()
+        SENT_REQUEST,
+        SENT_ONE_WAY  // request without response, already completed
+    };
+    // sends the next request if the window is not full yet
+    send_t sendNext ()
+    {
+        if (m_pending.size () >= m_window || m_sendDone)
+            return SENT_NOTHING;
 
-        std::chrono::duration<double, std::milli> roundtrip = end - start;
+        // responses of outstanding requests count as already received
+        if ((m_count && m_seq >= m_count) ||
+            isLimitReached (m_sendLimitOctets, getSentOctets(), m_currReqSize) ||
+            isLimitReached (m_recvLimitOctets, getReceivedOctets() + m_pendingRespOctets, m_currRespSize))
+        {
+            m_sendDone = true;
+            return SENT_NOTHING;
+        }
+
+        auto now = std::chrono::steady_clock::now ();
+        if (m_rate > 0 && now < m_nextSend)
+        {
+            m_notBefore = m_nextSend;
+            return SENT_LATER;
+        }
+        if (isThrottled (now))
+            return SENT_LATER;
+        if (m_rate > 0)
+        {
+            // the round trip starts at the scheduled time, so waiting for a full
+            // window or a slow event loop is part of it (no coordinated omission)
+            m_sendLag->record ((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_nextSend).count ());
+            now = m_nextSend;
+            m_nextSend += nextArrival ();
+        }
+
+        cRequest req;
+        req.m_seq      = ++m_seq;
+        req.m_reqSize  = m_currReqSize;
+        req.m_respSize = m_currRespSize;
+        req.m_start    = now;
+        sendRequest (req.m_seq, req.m_reqSize, req.m_respSize);
+        req.m_txId = getTxTimestampId ();
+        nextSize ();
+
+        if (!req.m_respSize)
+        {
+            // no response expected
+            completed (req, req.m_start);
+            return SENT_ONE_WAY;
+        }
+        m_pending.push_back (req);
+        m_pendingRespOctets += req.m_respSize;
+        return SENT_REQUEST;
+    }
+
+    void received (uint64_t seq)
+    {
+        auto end = std::chrono::steady_clock::now();
+
+        // in-order for stream sockets, datagrams might be reordered
+        auto it = m_pending.begin ();
+        while (it != m_pending.end () && it->m_seq != seq)
+            ++it;
+        if (it == m_pending.end ())
+        {
+            if (getOptions().m_verify != cProtocolOptions::VERIFY_NONE)
+                throw cProtocolException ("Unexpected sequence number");
+            it = m_pending.begin ();
+        }
+        cRequest req = *it;
+        m_pending.erase (it);
+        m_pendingRespOctets -= req.m_respSize;
+        if (isTimestamping ())
+            kernelRoundtrip (req, end);
+        if (m_requestPath)
+            oneWayDelays ();
+
+        completed (req, end);
+    }
+
+    // non-blocking sockets: the TX timestamp id is known when the whole request has been sent
+    void txCompleted ()
+    {
+        if (!m_pending.empty () && m_pending.back ().m_seq == m_txIncompleteSeq)
+            m_pending.back ().m_txId = getTxTimestampId ();
+        m_txIncompleteSeq = 0;
+    }
+
+    // compares the round trip time of the kernel (and NIC) with the one seen by us
+    void kernelRoundtrip (const cRequest& req, const std::chrono::steady_clock::time_point& end)
+    {
+        cSocket::timestamp tx;
+        const cSocket::timestamp& rx = getRxTimestamp ();
+        if (!getTxTimestamp (req.m_txId, tx))
+            return;
+
+        const uint64_t user = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - req.m_start).count ();
+        if (tx.software && rx.software >= tx.software)
+        {
+            const uint64_t kernel = rx.software - tx.software;
+            m_kernelLatency->record (kernel);
+            m_hostLatency->record (user > kernel ? user - kernel : 0);
+        }
+        if (tx.hardware && rx.hardware >= tx.hardware)
+            m_nicLatency->record (rx.hardware - tx.hardware);
+    }
+
+    /*
+     * Splits the round trip of the last response into both directions and
+     * the time spent in the server (T1: client send, T2: server receive,
+     * T3: server send, T4: client receive).
+     * The clocks of client and server differ by an unknown offset, which is
+     * estimated like NTP does: assuming symmetric paths, each round trip gives
+     * offset = ((T2 - T1) + (T3 - T4)) / 2. Queueing makes the paths asymmetric,
+     * so only the sample with the smallest delay of OFFSET_WINDOW round trips
+     * is used.
+     */
+    void oneWayDelays ()
+    {
+        const cProtocolTimestamps* ts = getRxHeaderTimestamps ();
+        if (!ts || !ts->getServerRecv ())
+            return; // response too small or server without header timestamps
+
+        const int64_t t1 = (int64_t)ts->getClientSend ();
+        const int64_t t2 = (int64_t)ts->getServerRecv ();
+        const int64_t t3 = (int64_t)ts->getServerSend ();
+        const int64_t t4 = (int64_t)getRxTime ();
+        const int64_t server = std::max (t3 - t2, (int64_t)0);
+        const uint64_t delay = (uint64_t)std::max ((t4 - t1) - server, (int64_t)1);
+        const int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+
+        if (!m_offsetSamples || delay < m_bestDelay)
+        {
+            m_bestDelay  = delay;
+            m_bestOffset = offset;
+        }
+        // until the first window is complete, the best sample so far is better than nothing
+        if (++m_offsetSamples >= OFFSET_WINDOW || !m_offsetValid)
+        {
+            m_clockOffset.store (m_bestOffset, std::memory_order_relaxed);
+            m_clockOffsetDelay.store (m_bestDelay, std::memory_order_relaxed);
+        }
+        if (m_offsetSamples >= OFFSET_WINDOW)
+        {
+            m_offsetSamples = 0;
+            m_offsetValid   = true;
+        }
+
+        const int64_t estimate = m_clockOffset.load (std::memory_order_relaxed);
+        m_requestPath->record ((uint64_t)std::max (t2 - t1 - estimate, (int64_t)0));
+        m_serverTime->record ((uint64_t)server);
+        m_responsePath->record ((uint64_t)std::max (t4 - t3 + estimate, (int64_t)0));
+    }
+
+    void completed (const cRequest& req, const std::chrono::steady_clock::time_point& end)
+    {
+        std::chrono::duration<double, std::milli> roundtrip = end - req.m_start;
+        if (req.m_respSize)
+            m_latency.record ((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - req.m_start).count ());
 
         if (m_wantStatus)
             Console::Print (" %4" PRIu64 ": sent %u bytes, received %u bytes, roundtrip %.3f ms\n",
-                m_seq, m_currReqSize, m_currRespSize, roundtrip);
-        if (m_delay)
+                req.m_seq, req.m_reqSize, req.m_respSize, roundtrip.count());
+        if (!m_delay)
+            return;
+        // an event loop must not sleep, it serves other connections meanwhile
+        if (isNonBlocking ())
+            m_notBefore = std::chrono::steady_clock::now () + std::chrono::microseconds (m_delay);
+        else
             std::this_thread::sleep_for (std::chrono::microseconds (m_delay));
+    }
+
+    // shared limits: takes the tokens of the next request (once, waiting keeps its place
+    // in the buckets) and returns true if they may not be used before getNotBefore ()
+    bool isThrottled (const std::chrono::steady_clock::time_point& now)
+    {
+        if (!m_byteLimit && !m_requestLimit)
+            return false;
+        if (!m_tokensTaken)
+        {
+            m_tokensTaken = true;
+            m_tokensReady = now;
+            if (m_byteLimit)
+                m_tokensReady = std::max (m_tokensReady, m_byteLimit->acquire (m_currReqSize));
+            if (m_requestLimit)
+                m_tokensReady = std::max (m_tokensReady, m_requestLimit->acquire (1));
+        }
+        if (now < m_tokensReady)
+        {
+            m_notBefore = m_tokensReady;
+            return true;
+        }
+        m_tokensTaken = false;
+        return false;
+    }
+
+    // open loop: time between two scheduled requests
+    std::chrono::steady_clock::duration nextArrival ()
+    {
+        const double interval = m_poisson ? m_arrivals (m_arrivalRng) : 1.0 / m_rate;
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double> (interval));
+    }
 
+    void nextSize ()
+    {
         if (m_comSettings.isRand ())
         {
             // generate random delta for request and response
@@ -101,24 +450,52 @@ public:
         }
     }
 
-    void getStats (cStats& stats)
-    {
-        cBabblerProtocol::getStats (stats);
-    }
-
-private:
     const cComSettings m_comSettings;
     unsigned m_currReqSize;
     unsigned m_currRespSize;
     std::uniform_int_distribution<std::mt19937::result_type> m_reqDelta;
     std::uniform_int_distribution<std::mt19937::result_type> m_respDelta;
     const uint64_t m_delay;
+    const uint64_t m_count;  // number of requests, 0 means infinite
+    const unsigned m_window; // max. number of outstanding requests
+    const double m_rate;     // open loop: requests per second, 0: closed loop
+    const bool m_poisson;    // open loop: exponentially distributed intervals instead of fixed ones
+    std::exponential_distribution<double> m_arrivals;
+    std::mt19937 m_arrivalRng;  // own seed per connection, their arrivals must be independent
+    std::chrono::steady_clock::time_point m_nextSend; // open loop: scheduled time of the next request
+    cTokenBucket* m_byteLimit;     // shared by all connections, nullptr: unlimited
+    cTokenBucket* m_requestLimit;
+    bool m_tokensTaken;            // for the next request, which waits until m_tokensReady
+    std::chrono::steady_clock::time_point m_tokensReady;
     int_fast64_t m_sendLimitOctets;
     int_fast64_t m_recvLimitOctets;
     uint64_t m_seq;
     std::mt19937 m_rng;
+    std::deque<cRequest> m_pending;
+    int_fast64_t m_pendingRespOctets;
+    bool m_sendDone;
+    std::chrono::steady_clock::time_point m_notBefore; // non-blocking sockets with interval
+    cSharedLatencyHistogram m_latency;
+    std::unique_ptr<cSharedLatencyHistogram> m_sendLag; // only in open loop
+    // only with kernel timestamps
+    std::unique_ptr<cSharedLatencyHistogram> m_kernelLatency;
+    std::unique_ptr<cSharedLatencyHistogram> m_nicLatency;
+    std::unique_ptr<cSharedLatencyHistogram> m_hostLatency;
 
     const bool m_wantStatus;
+    uint64_t m_txIncompleteSeq; // non-blocking sockets: request which is not sent completely
+
+    // only with header timestamps
+    static const unsigned OFFSET_WINDOW = 1024;
+    std::unique_ptr<cSharedLatencyHistogram> m_requestPath;
+    std::unique_ptr<cSharedLatencyHistogram> m_serverTime;
+    std::unique_ptr<cSharedLatencyHistogram> m_responsePath;
+    std::atomic<int_fast64_t> m_clockOffset;  // current estimate, read by getStats
+    std::atomic<uint64_t> m_clockOffsetDelay; // 0: no estimate yet
+    unsigned m_offsetSamples;                 // in the current window
+    bool     m_offsetValid;                   // at least one window complete
+    int64_t  m_bestOffset;                    // sample with the smallest delay in the current window
+    uint64_t m_bestDelay;
 };
 
 
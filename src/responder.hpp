@@ -24,8 +24,8 @@
 class cResponder : public cBabblerProtocol
 {
 public:
-    cResponder (cSocket& sock, unsigned bufsize, bool isConnectionless = false)
-        : cBabblerProtocol (sock, bufsize),
+    cResponder (cSocket& sock, unsigned bufsize, const cProtocolOptions& options, bool isConnectionless = false)
+        : cBabblerProtocol (sock, bufsize, options),
           m_isConnectionless (isConnectionless),
           m_remoteAddr (nullptr)
     {
@@ -57,6 +57,29 @@ public:
             sendResponse (seq, expSeqLen);
         }
     }
+
+    enum state_t
+    {
+        WANT_READ,  // waiting for (the rest of) the next request
+        WANT_WRITE, // a response could not be sent completely
+        BUSY        // budget exhausted, there might be more requests
+    };
+    // non-blocking sockets: answers up to budget requests without waiting
+    state_t serve (unsigned budget)
+    {
+        uint64_t seq;
+        uint32_t expSeqLen;
+
+        for (unsigned n = 0; n < budget; n++)
+        {
+            if (!sendPending ())
+                return WANT_WRITE;
+            if (!tryRecvRequest (seq, expSeqLen))
+                return WANT_READ;
+            sendResponse (seq, expSeqLen);
+        }
+        return sendPending () ? BUSY : WANT_WRITE;
+    }
 private:
     bool m_isConnectionless;
     sockaddr_storage* m_remoteAddr;
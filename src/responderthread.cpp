@@ -19,12 +19,16 @@
 #include "responderthread.hpp"
 #include "console.hpp"
 #include "responder.hpp"
+#include "affinity.hpp"
 
 
-cResponderThread::cResponderThread (cSemaphore& threadLimit, cSocket s, unsigned socketBufSize, const char* proto, bool isConnectionless)
+cResponderThread::cResponderThread (cSemaphore& threadLimit, cSocket s, unsigned socketBufSize, const cProtocolOptions& options,
+    const char* proto, bool isConnectionless, int cpu)
 : m_finished (false),
+  m_requests (0),
   m_isConnectionless (isConnectionless),
-  m_thread (&cResponderThread::connectionThreadFunc, this, std::move(s), socketBufSize, std::ref(threadLimit), proto)
+  m_responder (nullptr),
+  m_thread (&cResponderThread::connectionThreadFunc, this, std::move(s), socketBufSize, options, std::ref(threadLimit), proto, cpu)
 {
 
 }
@@ -34,16 +38,33 @@ cResponderThread::~cResponderThread ()
     m_thread.join ();
 }
 
-void cResponderThread::connectionThreadFunc (cSocket s, unsigned socketBufSize, cSemaphore& threadLimit, const char* proto)
+void cResponderThread::connectionThreadFunc (cSocket s, unsigned socketBufSize, cProtocolOptions options, cSemaphore& threadLimit, const char* proto,
+    int cpu)
 {
     Console::PrintDebug ("%s responder thread started\n", proto);
+    // before the responder allocates its buffers
+    if (!cAffinity::pin (cpu))
+        Console::PrintError ("Could not pin %s responder thread to CPU %d\n", proto, cpu);
     try
     {
-        cResponder responder (s, socketBufSize, m_isConnectionless);
+        cResponder responder (s, socketBufSize, options, m_isConnectionless);
+        m_lock.lock ();
+        m_responder = &responder;
+        m_lock.unlock ();
 
-        while (1)
+        try
         {
-            responder.doJob ();
+            while (1)
+            {
+                responder.doJob ();
+                m_requests.store (m_requests.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock (m_lock);
+            m_responder = nullptr;
+            throw;
         }
     }
     catch (const cSocket::errorException& e)
@@ -53,4 +74,11 @@ void cResponderThread::connectionThreadFunc (cSocket s, unsigned socketBufSize,
     Console::PrintDebug ("%s responder thread terminated\n", proto);
     m_finished = true;
     threadLimit.post ();
-}
\ No newline at end of file
+}
+
+void cResponderThread::getStats (cStats& stats)
+{
+    std::lock_guard<std::mutex> lock (m_lock);
+    if (m_responder)
+        m_responder->getStats (stats);
+}
@@ -21,23 +21,37 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
 
 #include "socket.hpp"
 #include "semaphore.hpp"
+#include "protocoloptions.hpp"
+#include "stats.hpp"
+
+class cResponder;
 
 
 class cResponderThread
 {
 public:
-    cResponderThread (cSemaphore& threadLimit, cSocket s, unsigned socketBufSize, const char* proto, bool isConnectionless = false);
+    cResponderThread (cSemaphore& threadLimit, cSocket s, unsigned socketBufSize, const cProtocolOptions& options,
+        const char* proto, bool isConnectionless = false, int cpu = -1);
     ~cResponderThread ();
     bool isFinished () {return m_finished;}
+    // answered requests so far
+    uint64_t requests () const {return m_requests.load (std::memory_order_relaxed);}
+    // counters of the connection (see cBabblerProtocol::getStats), unchanged if it is finished
+    void getStats (cStats& stats);
 
-    void connectionThreadFunc (cSocket s, unsigned socketBufSize, cSemaphore& threadLimit, const char* proto);
+    void connectionThreadFunc (cSocket s, unsigned socketBufSize, cProtocolOptions options, cSemaphore& threadLimit, const char* proto,
+        int cpu);
 
 private:
     std::atomic<bool> m_finished;
+    std::atomic<uint64_t> m_requests; // only written by the thread itself
     bool              m_isConnectionless;
+    std::mutex        m_lock;      // protects m_responder, not taken by the thread per request
+    cResponder*       m_responder; // lives on the stack of the thread
     std::thread       m_thread;
 };
 
@@ -16,43 +16,71 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <unistd.h>
+#include <algorithm>
+
 #include "serverstateful.hpp"
 #include "console.hpp"
 
-cStatefulServer::cStatefulServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize, cSemaphore& threadLimit)
+cStatefulServer::cStatefulServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize,
+    const cProtocolOptions& options, cSemaphore& threadLimit, cReactor* reactor, bool sharded,
+    cAffinity* affinity)
     : m_terminate (false),
       m_threadLimit (threadLimit),
-      m_listenerThread (nullptr),
+      m_reactor (reactor),
+      m_affinity (affinity),
       m_protocol (proto),
       m_localPort (localPort),
-      m_socketBufSize (socketBufSize)
+      m_socketBufSize (socketBufSize),
+      m_options (options)
 {
-    m_listenerThread = new std::thread (&cStatefulServer::listenerThreadFunc, this);
+    unsigned shards = 1;
+    if (sharded)
+    {
+        // listener n hands its connections to reactor loop n
+        long numberOfCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (m_reactor)
+            shards = m_reactor->threads ();
+        else if (m_affinity && m_affinity->isEnabled ())
+            shards = m_affinity->count ();
+        else
+            shards = (unsigned)std::max (numberOfCPUs, 1L);
+    }
+    for (unsigned n = 0; n < shards; n++)
+        m_listenerThreads.push_back (new std::thread (&cStatefulServer::listenerThreadFunc, this, n, shards));
 }
 
 cStatefulServer::~cStatefulServer ()
 {
-    if (m_listenerThread)
-    {
-        m_listenerThread->join ();
-        delete m_listenerThread;
-    }
-
-    for (auto thread : m_connThreads)
+    for (auto thread : m_listenerThreads)
     {
+        thread->join ();
         delete thread;
     }
 }
 
-void cStatefulServer::listenerThreadFunc ()
+void cStatefulServer::listenerThreadFunc (unsigned shard, unsigned shards)
 {
-    Console::PrintDebug ("%s listener thread started \n", m_protocol.toString());
+    Console::PrintDebug ("%s listener thread %u started \n", m_protocol.toString(), shard);
+    std::list<cResponderThread*> connThreads;
     try
     {
-        cSocket sListener = cSocket::listen (m_protocol, m_localPort, 50);
+        // the reactor is made for lots of clients connecting at once
+        cSocket sListener = cSocket::listen (m_protocol, m_localPort, m_reactor ? SOMAXCONN : 50, shards > 1);
+        // the kernel prefers the listener of the CPU which processed the connection request,
+        // the listener and its connections (threads or reactor loop) stay on that CPU
+        int cpu = -1;
+        if (shards > 1)
+        {
+            cpu = m_affinity ? m_affinity->shardCpu (shard) : (int)shard;
+            sListener.setIncomingCpu (cpu);
+        }
+        if (!cAffinity::pin (cpu))
+            Console::PrintError ("Could not pin %s listener thread to CPU %d\n", m_protocol.toString(), cpu);
         while (!m_terminate)
         {
-            m_threadLimit.wait ();
+            if (!m_reactor)
+                m_threadLimit.wait ();
             std::string remoteIp;
             uint16_t remotePort;
 
@@ -60,17 +88,26 @@ void cStatefulServer::listenerThreadFunc ()
             Console::PrintVerbose ("Client %s:%u connected to %s port %u\n",
                 remoteIp.c_str(), remotePort, m_protocol.toString(), m_localPort);
 
-            // create thread for this connection
-            m_connThreads.push_back (new cResponderThread (m_threadLimit, std::move(sConn),
-                m_socketBufSize, m_protocol.toString()));
+            if (m_reactor)
+            {
+                // sharded connections never leave the loop of their listener
+                m_reactor->add (std::move(sConn), m_socketBufSize, m_options, m_protocol.toString(),
+                    shards > 1 ? (int)shard : -1);
+                continue;
+            }
+
+            // create thread for this connection, sharded ones run on the CPU of their listener
+            connThreads.push_back (new cResponderThread (m_threadLimit, std::move(sConn),
+                m_socketBufSize, m_options, m_protocol.toString(), false,
+                shards > 1 ? cpu : m_affinity ? m_affinity->next () : -1));
 
             // cleanup terminated threads
-            for (auto it = m_connThreads.begin(); it != m_connThreads.end();)
+            for (auto it = connThreads.begin(); it != connThreads.end();)
             {
                 if ((*it)->isFinished())
                 {
                     delete *it;
-                    it = m_connThreads.erase (it);
+                    it = connThreads.erase (it);
                 }
                 else
                     ++it;
@@ -81,5 +118,10 @@ void cStatefulServer::listenerThreadFunc ()
     {
         Console::PrintError ("%s\n", e.what());
     }
-    Console::PrintDebug ("%s listener thread terminated \n", m_protocol.toString());
+
+    for (auto thread : connThreads)
+    {
+        delete thread;
+    }
+    Console::PrintDebug ("%s listener thread %u terminated \n", m_protocol.toString(), shard);
 }
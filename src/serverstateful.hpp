@@ -23,28 +23,37 @@
 #include <thread>
 #include <atomic>
 #include <list>
+#include <vector>
 
 #include "socket.hpp"
 #include "semaphore.hpp"
+#include "protocoloptions.hpp"
 #include "responderthread.hpp"
+#include "reactor.hpp"
+#include "affinity.hpp"
 
 
 class cStatefulServer
 {
 public:
-    cStatefulServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize, cSemaphore& threadLimit);
+    cStatefulServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize,
+        const cProtocolOptions& options, cSemaphore& threadLimit, cReactor* reactor = nullptr,
+        bool sharded = false, cAffinity* affinity = nullptr);
     ~cStatefulServer ();
 
 private:
-    void listenerThreadFunc ();
+    void listenerThreadFunc (unsigned shard, unsigned shards);
 
     std::atomic<bool>       m_terminate;
     cSemaphore&             m_threadLimit;
-    std::thread*            m_listenerThread;
+    cReactor*               m_reactor;  // serves the connections if not nullptr, no threads per connection
+    cAffinity*              m_affinity; // CPUs of listener and responder threads, nullptr: no pinning
+    // sharded: one SO_REUSEPORT listener per CPU (or reactor loop), each with its own thread
+    std::vector<std::thread*> m_listenerThreads;
     const cSocket::Properties m_protocol;
     uint16_t                m_localPort;
-    std::list<cResponderThread*> m_connThreads;
     unsigned                m_socketBufSize;
+    const cProtocolOptions  m_options;
 };
 
 #endif
\ No newline at end of file
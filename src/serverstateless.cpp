@@ -19,21 +19,29 @@
 #include "serverstateless.hpp"
 #include "console.hpp"
 
-cStatelessServer::cStatelessServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize, cSemaphore& threadLimit)
+cStatelessServer::cStatelessServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize,
+    const cProtocolOptions& options, cSemaphore& threadLimit, bool incomingCpu,
+    const cAffinity* affinity)
     : m_terminate (false),
       m_threadLimit (threadLimit),
       m_protocol (proto),
       m_localPort (localPort),
-      m_socketBufSize (socketBufSize)
+      m_socketBufSize (socketBufSize),
+      m_options (options)
 {
     try
     {
-        cSocket sListener = cSocket::listen (m_protocol, m_localPort, 0);
-        long numberOfCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+        long numberOfCPUs = std::max (sysconf(_SC_NPROCESSORS_ONLN), 1L);
 
-        for (int n = std::max ((int)numberOfCPUs, 4); n > 0; n--)
+        // Every worker has its own socket and the kernel hashes the flows to them.
+        // With one shared socket, all workers would wake up for each datagram.
+        for (int n = 0; n < std::max ((int)numberOfCPUs, 4); n++)
         {
-            m_connThreads.push_back (new cResponderThread(threadLimit, std::move(sListener.clone()), socketBufSize, proto.toString(), true));
+            const int cpu = affinity ? affinity->cpu ((unsigned)n) : -1;
+            cSocket sWorker = cSocket::listen (m_protocol, m_localPort, 0, true);
+            if (incomingCpu)
+                sWorker.setIncomingCpu (cpu >= 0 ? cpu : n % (int)numberOfCPUs);
+            m_connThreads.push_back (new cResponderThread(threadLimit, std::move(sWorker), socketBufSize, m_options, proto.toString(), true, cpu));
         }
     }
     catch (const cSocket::errorException& e)
@@ -50,3 +58,25 @@ cStatelessServer::~cStatelessServer ()
         delete thread;
     }
 }
+
+std::vector<uint64_t> cStatelessServer::getWorkerRequests () const
+{
+    std::vector<uint64_t> requests;
+    for (auto thread : m_connThreads)
+    {
+        requests.push_back (thread->requests ());
+    }
+    return requests;
+}
+
+cStats cStatelessServer::getStats () const
+{
+    cStats total;
+    for (auto thread : m_connThreads)
+    {
+        cStats stats;
+        thread->getStats (stats);
+        total += stats;
+    }
+    return total;
+}
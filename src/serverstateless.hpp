@@ -23,18 +23,29 @@
 #include <thread>
 #include <atomic>
 #include <list>
+#include <vector>
 
 #include "socket.hpp"
 #include "semaphore.hpp"
+#include "protocoloptions.hpp"
 #include "responderthread.hpp"
+#include "affinity.hpp"
 
 
 class cStatelessServer
 {
 public:
-    cStatelessServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize, cSemaphore& threadLimit);
+    cStatelessServer (const cSocket::Properties& proto, uint16_t localPort, unsigned socketBufSize,
+        const cProtocolOptions& options, cSemaphore& threadLimit, bool incomingCpu = false,
+        const cAffinity* affinity = nullptr);
     ~cStatelessServer ();
 
+    uint16_t getPort () const {return m_localPort;}
+    // answered requests of each worker, shows how the kernel distributes the flows
+    std::vector<uint64_t> getWorkerRequests () const;
+    // counters of all workers together
+    cStats getStats () const;
+
 private:
     void listenerThreadFunc ();
 
@@ -44,6 +55,7 @@ private:
     uint16_t                m_localPort;
     std::list<cResponderThread*> m_connThreads;
     unsigned                m_socketBufSize;
+    const cProtocolOptions  m_options;
 };
 
 #endif
\ No newline at end of file
@@ -17,19 +17,34 @@
  */
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include <sstream>
+#include <algorithm>
+#include <chrono>
 
 #include "bug.hpp"
 #include "socket.hpp"
+#include "uring.hpp"
 #include "console.hpp"
 
 std::mutex cSocket::cHandle::m_lock;
 std::map<int, unsigned> cSocket::cHandle::m_fdRefs;
+cSocket::ioEngine_t cSocket::m_ioEngine = cSocket::IO_POLL;
+unsigned cSocket::m_busyPollUs = 0;
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69  // Linux 5.11
+#endif
 
-cSocket::cSocket () : m_fd (-1), m_timeout_ms (-1)
+
+cSocket::cSocket () : m_fd (-1), m_timeout_ms (-1), m_uring (nullptr), m_nonBlocking (false),
+      m_cancel (nullptr)
 {
     initPoll (-1);
 }
@@ -39,6 +54,13 @@ cSocket::cSocket (cSocket&& obj)
 {
     std::memcpy (&m_pollfd, &obj.m_pollfd, sizeof (m_pollfd));
     m_timeout_ms = obj.m_timeout_ms;
+    m_zc         = obj.m_zc;
+    m_uring      = obj.m_uring;
+    obj.m_uring  = nullptr;
+    m_nonBlocking = obj.m_nonBlocking;
+    m_cancel     = obj.m_cancel;
+    m_ts         = std::move (obj.m_ts);
+    m_pace       = std::move (obj.m_pace);
 }
 
 /*
@@ -51,7 +73,8 @@ cSocket::cSocket (cSocket&& obj)
  * dccp: AF_INET/AF_INET6, SOCK_DCCP, IPPROTO_DCCP
  */
 cSocket::cSocket (int domain, int type, int protocol, int timeout)
-    : m_fd (-1), m_timeout_ms (timeout)
+    : m_fd (-1), m_timeout_ms (timeout), m_uring (nullptr), m_nonBlocking (false),
+      m_cancel (nullptr)
 {
     m_fd = socket (domain, type, protocol);
 
@@ -61,22 +84,35 @@ cSocket::cSocket (int domain, int type, int protocol, int timeout)
     }
 
     initPoll (-1);
+    initEngine ();
 }
 
 cSocket::cSocket (int fd, int timeout)
-    : m_fd(fd), m_timeout_ms (timeout)
+    : m_fd(fd), m_timeout_ms (timeout), m_uring (nullptr), m_nonBlocking (false),
+      m_cancel (nullptr)
 {
     initPoll (-1);
+    initEngine ();
 }
 
 cSocket::~cSocket ()
 {
+    // the ring holds a reference to the socket, so it must be gone before the socket is closed
+    delete m_uring;
 }
 
 cSocket& cSocket::operator= (cSocket&& obj)
 {
+    delete m_uring;
     std::memcpy (&m_pollfd, &obj.m_pollfd, sizeof (m_pollfd));
     m_timeout_ms = obj.m_timeout_ms;
+    m_zc         = obj.m_zc;
+    m_uring      = obj.m_uring;
+    obj.m_uring  = nullptr;
+    m_nonBlocking = obj.m_nonBlocking;
+    m_cancel     = obj.m_cancel;
+    m_ts         = std::move (obj.m_ts);
+    m_pace       = std::move (obj.m_pace);
     m_fd         = std::move(obj.m_fd);
 
     return *this;
@@ -84,15 +120,72 @@ cSocket& cSocket::operator= (cSocket&& obj)
 
 cSocket cSocket::clone () const
 {
+    // each clone gets its own ring, rings must not be shared between threads
     cSocket theClone (m_fd, m_timeout_ms);
-    std::memcpy (&theClone.m_pollfd, &m_pollfd, sizeof (m_pollfd));
+    if (m_pollfd[1].fd >= 0)
+        theClone.initPoll (m_pollfd[1].fd);
+    theClone.m_cancel = m_cancel;
+    if (m_nonBlocking)
+        theClone.setNonBlocking ();
 
     return theClone;
 }
 
+bool cSocket::setIoEngine (ioEngine_t engine)
+{
+    if (engine == IO_URING && !cUring::isSupported ())
+        return false;
+    m_ioEngine = engine;
+    return true;
+}
+
+void cSocket::setBusyPoll (unsigned usecs)
+{
+    m_busyPollUs = usecs;
+}
+
+void cSocket::initEngine ()
+{
+    // best effort: values above net.core.busy_read need CAP_NET_ADMIN,
+    // the spin in user space works anyway
+    if (m_busyPollUs)
+    {
+        const int usecs  = (int)m_busyPollUs;
+        const int prefer = 1;
+        setsockopt (m_fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof (usecs));
+        setsockopt (m_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof (prefer));
+    }
+
+    // waiting on the ring doesn't implement receive timeouts
+    if (m_ioEngine == IO_URING && m_timeout_ms < 0)
+        m_uring = cUring::create (m_fd);
+}
+
 void cSocket::setCancelEvent (cEvent& eventCancel)
 {
     initPoll (eventCancel);
+    m_cancel = &eventCancel;
+}
+
+void cSocket::close ()
+{
+    // the ring holds a reference to the socket, so it must be gone first
+    delete m_uring;
+    m_uring = nullptr;
+    m_fd.reset ();
+    m_pollfd[0].fd = -1;
+}
+
+void cSocket::setNonBlocking ()
+{
+    int flags = fcntl (m_fd, F_GETFL);
+    if (flags < 0 || fcntl (m_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        throw errorException (errno);
+    m_nonBlocking = true;
+
+    // the owner waits for readiness, not the ring
+    delete m_uring;
+    m_uring = nullptr;
 }
 
 void cSocket::initPoll (int evfd)
@@ -101,6 +194,13 @@ void cSocket::initPoll (int evfd)
     m_pollfd[1].fd = evfd;
     m_pollfd[0].events = POLLIN;
     m_pollfd[1].events = POLLIN;
+
+    // without the cancel event in the ring, we could not be terminated
+    if (m_uring && evfd >= 0 && !m_uring->setCancelEvent (evfd))
+    {
+        delete m_uring;
+        m_uring = nullptr;
+    }
 }
 
 cSocket cSocket::connect (const Properties& prop, const std::string& node, uint16_t remotePort,
@@ -141,13 +241,25 @@ cSocket cSocket::connect (const Properties& prop, const std::string& node, uint1
     return cSocket(); // error
 }
 
-cSocket cSocket::listen (const Properties& prop, uint16_t port, int backlog)
+std::pair<cSocket, cSocket> cSocket::pair (int type)
+{
+    int fds[2];
+    if (::socketpair (AF_UNIX, type, 0, fds))
+        throw errorException (errno);
+    return std::make_pair (cSocket (fds[0], -1), cSocket (fds[1], -1));
+}
+
+cSocket cSocket::listen (const Properties& prop, uint16_t port, int backlog, bool reusePort)
 {
     int domain = prop.family();
     // AF_UNSPEC means IPv4 AND IPv6
     cSocket sListener (domain == AF_UNSPEC ? AF_INET6 : AF_INET, prop.type(), prop.protocol());
 
     sListener.enableOption (SOL_SOCKET, SO_REUSEADDR);
+    if (reusePort)
+    {
+        sListener.enableOption (SOL_SOCKET, SO_REUSEPORT);
+    }
     if (domain == AF_INET6)
     {
         sListener.enableOption (IPPROTO_IPV6, IPV6_V6ONLY);
@@ -191,8 +303,16 @@ cSocket cSocket::accept (std::string& addr, uint16_t& port)
     std::memset (&address, 0, sizeof(address));
     socklen_t addrLen = sizeof (address);
 
-    int ret = ::accept (m_fd, (struct sockaddr *)&address, &addrLen);
-    if (ret < 0)
+    int ret;
+    if (m_uring)
+    {
+        ret = m_uring->accept ((struct sockaddr *)&address, &addrLen);
+        if (ret == -ECANCELED)
+            throw eventException ();
+        if (ret < 0)
+            throw errorException (-ret);
+    }
+    else if ((ret = ::accept (m_fd, (struct sockaddr *)&address, &addrLen)) < 0)
     {
         throw errorException (errno);
     }
@@ -204,6 +324,8 @@ cSocket cSocket::accept (std::string& addr, uint16_t& port)
 
 bool cSocket::connect (const struct sockaddr *adr, socklen_t adrlen) noexcept
 {
+    if (m_uring)
+        return m_uring->connect (adr, adrlen) == 0;
     return ::connect (m_fd, adr, adrlen) == 0;
 }
 
@@ -216,60 +338,273 @@ ssize_t cSocket::recv (void *buf, size_t len, size_t atleast,
     size_t received = 0;
     do
     {
-        int pollret = poll (m_pollfd, 2, m_timeout_ms);
-        if (pollret < 0)
-        {
-            throw errorException (errno);
-        }
-        else if (pollret == 0)
-        {
-            throw errorException ("Receive timeout");
-        }
+        struct iovec iov;
+        iov.iov_base = p + received;
+        iov.iov_len  = len - received;
+        received += recvv (&iov, 1, src_addr, addrlen);
+    } while (received < atleast);
 
-        // connection terminated
-        if (m_pollfd[0].revents & (POLLERR | POLLHUP))
-        {
-            throw errorException (ECONNRESET);
-        }
+    return received;
+}
 
-        // data received
-        if (m_pollfd[0].revents & POLLIN)
+/*
+ * Calls recv (a non-blocking receive) and returns its result. With busy poll,
+ * it is repeated for up to m_busyPollUs as long as it fails with EAGAIN.
+ * The caller only waits with poll if the result is still EAGAIN.
+ */
+template <typename F>
+auto cSocket::tryRecv (F recv) -> decltype (recv ())
+{
+    auto ret = recv ();
+    if (ret >= 0 || (errno != EWOULDBLOCK && errno != EAGAIN) || !m_busyPollUs)
+        return ret;
+
+    const auto deadline = std::chrono::steady_clock::now () + std::chrono::microseconds (m_busyPollUs);
+    do
+    {
+        ret = recv ();
+        if (ret >= 0 || (errno != EWOULDBLOCK && errno != EAGAIN))
+            break;
+    } while (std::chrono::steady_clock::now () < deadline);
+    return ret;
+}
+
+// waits for received data, returns false if there was nothing to read after all
+bool cSocket::pollIn ()
+{
+    int pollret = poll (m_pollfd, 2, m_timeout_ms);
+    if (pollret < 0)
+    {
+        throw errorException (errno);
+    }
+    else if (pollret == 0)
+    {
+        throw errorException ("Receive timeout");
+    }
+
+    // with zerocopy or timestamping, POLLERR also signals notifications in the error queue
+    if ((m_zc.enabled || m_ts.enabled) && (m_pollfd[0].revents & POLLERR))
+    {
+        reapErrorQueue ();
+        int err = 0;
+        socklen_t len = sizeof (err);
+        if (!::getsockopt (m_fd, SOL_SOCKET, SO_ERROR, &err, &len) && err)
+            throw errorException (err);
+        m_pollfd[0].revents &= ~POLLERR;
+    }
+
+    // connection terminated
+    if (m_pollfd[0].revents & (POLLERR | POLLHUP))
+    {
+        throw errorException (ECONNRESET);
+    }
+
+    // termination request
+    if (m_pollfd[1].revents & POLLIN)
+    {
+        throw eventException ();
+    }
+
+    return m_pollfd[0].revents & POLLIN;
+}
+
+bool cSocket::canRecvInPlace () const
+{
+    return m_uring && m_uring->isStream ();
+}
+
+ssize_t cSocket::recvInPlace (const uint8_t*& data, void* scratch, size_t len)
+{
+    BUG_ON (!canRecvInPlace ());
+
+    ssize_t ret = m_uring->recvInPlace (data, scratch, len);
+    if (ret == -ECANCELED)
+        throw eventException ();
+    if (ret <= 0)
+        throw errorException (ret == 0 ? ECONNRESET : (int)-ret);
+    return ret;
+}
+
+void cSocket::releaseInPlace (size_t len)
+{
+    if (m_uring)
+        m_uring->release (len);
+}
+
+ssize_t cSocket::recvv (const struct iovec *iov, int iovcnt,
+    struct sockaddr * src_addr, socklen_t * addrlen, unsigned* segments)
+{
+    ssize_t received = 0;
+
+    // the ring waits for data and the cancel event with the same syscall,
+    // stream data is usually already there without any syscall
+    if (m_uring)
+    {
+        ssize_t ret;
+        if (src_addr || segments)
         {
-            /*
-             We don't want to block here because we are using poll to be able to
-             react on timeouts and termination requests.
-             recvfrom will only block when two or more threads are sharing a socket. 
-             When data arrives both are unblocked (poll returns) and the first thread that calls 
-             recfrom will get the data. The second thread will be blocked by recfrom because there
-             is no more data to receive.
-             */
-            ssize_t ret = ::recvfrom (m_fd, p, len - received, MSG_DONTWAIT, src_addr, addrlen);
-            if (ret <= 0)
+            struct msghdr msg;
+            std::memset (&msg, 0, sizeof (msg));
+            msg.msg_name    = src_addr;
+            msg.msg_namelen = addrlen ? *addrlen : 0;
+            msg.msg_iov     = const_cast<struct iovec*>(iov);
+            msg.msg_iovlen  = iovcnt;
+            uint8_t control[GRO_CONTROL_SIZE];
+            if (segments)
             {
-                // in case recfrom would block we ignore it and continue. 
-                if (errno != EWOULDBLOCK && errno != EAGAIN)
-                    throw errorException (ret == 0 ? ECONNRESET : errno);
+                msg.msg_control    = control;
+                msg.msg_controllen = sizeof (control);
             }
-            else
+            ret = m_uring->recvmsg (&msg);
+            if (ret > 0)
             {
-                received += ret;
-                p += ret;
+                if (addrlen)
+                    *addrlen = msg.msg_namelen;
+                if (segments)
+                    *segments = groSegments (msg, (size_t)ret);
             }
         }
-
-        // termination request
-        if (m_pollfd[1].revents & POLLIN)
+        else
         {
-            throw eventException ();
+            ret = m_uring->recv (iov, iovcnt);
         }
-    } while (received < atleast);
+        if (ret == -ECANCELED)
+            throw eventException ();
+        if (ret <= 0)
+            throw errorException (ret == 0 ? ECONNRESET : (int)-ret);
+        return ret;
+    }
+
+    struct msghdr msg;
+    std::memset (&msg, 0, sizeof (msg));
+    msg.msg_name    = src_addr;
+    msg.msg_namelen = addrlen ? *addrlen : 0;
+    msg.msg_iov     = const_cast<struct iovec*>(iov);
+    msg.msg_iovlen  = iovcnt;
+    uint8_t control[RX_CONTROL_SIZE];
+    if (segments || m_ts.enabled)
+    {
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof (control);
+    }
+
+    /*
+     We never block in recvmsg, because we have to react on timeouts and termination
+     requests. Usually data is already there, so we try to receive first and
+     only wait with poll (socket and cancel event) if there is nothing yet.
+     The termination request is checked without syscall before.
+     Non-blocking sockets are only read when the owner knows there is data.
+     recvmsg after poll finds nothing, if two or more threads are sharing a socket
+     and another one got the data first.
+     */
+    if (!m_nonBlocking && isCancelled ())
+        throw eventException ();
+    ssize_t ret = m_nonBlocking ? ::recvmsg (m_fd, &msg, MSG_DONTWAIT) :
+        tryRecv ([&]() {return ::recvmsg (m_fd, &msg, MSG_DONTWAIT);});
+    if (ret < 0 && (errno == EWOULDBLOCK || errno == EAGAIN) && !m_nonBlocking && pollIn ())
+        ret = ::recvmsg (m_fd, &msg, MSG_DONTWAIT);
+
+    if (ret <= 0)
+    {
+        // in case recvmsg would block we ignore it and continue.
+        if (ret == 0 || (errno != EWOULDBLOCK && errno != EAGAIN))
+            throw errorException (ret == 0 ? ECONNRESET : errno);
+        // an event loop would be woken up by the error queue again and again
+        if (m_nonBlocking && m_ts.enabled)
+            reapErrorQueue ();
+    }
+    else
+    {
+        received = ret;
+        if (addrlen)
+            *addrlen = msg.msg_namelen;
+        if (segments)
+            *segments = groSegments (msg, (size_t)ret);
+        if (m_ts.enabled)
+            rxTimestamp (msg, m_ts.rx);
+    }
 
     return received;
 }
 
+int cSocket::recvmmsg (struct mmsghdr *msgs, unsigned vlen)
+{
+    // see recvv, why we receive before we wait and never block
+    if (!m_nonBlocking && isCancelled ())
+        throw eventException ();
+    int ret = m_nonBlocking ? ::recvmmsg (m_fd, msgs, vlen, MSG_DONTWAIT, nullptr) :
+        tryRecv ([&]() {return ::recvmmsg (m_fd, msgs, vlen, MSG_DONTWAIT, nullptr);});
+    if (ret < 0 && (errno == EWOULDBLOCK || errno == EAGAIN) && !m_nonBlocking && pollIn ())
+        ret = ::recvmmsg (m_fd, msgs, vlen, MSG_DONTWAIT, nullptr);
+    if (ret < 0)
+    {
+        if (errno != EWOULDBLOCK && errno != EAGAIN)
+            throw errorException (errno);
+        if (m_nonBlocking && m_ts.enabled)
+            reapErrorQueue ();
+        ret = 0;
+    }
+    return ret;
+}
+
+ssize_t cSocket::sendmmsg (struct mmsghdr *msgs, unsigned vlen, unsigned* calls)
+{
+    // one launch time per datagram, as the kernel sends them
+    if (m_pace.txtime)
+    {
+        const size_t words = CMSG_SPACE (sizeof (uint64_t)) / sizeof (uint64_t);
+        if (m_pace.control.size () < vlen * words)
+            m_pace.control.resize (vlen * words);
+        for (unsigned n = 0; n < vlen; n++)
+        {
+            if (msgs[n].msg_hdr.msg_control)
+                continue;
+            size_t octets = 0;
+            for (size_t i = 0; i < msgs[n].msg_hdr.msg_iovlen; i++)
+                octets += msgs[n].msg_hdr.msg_iov[i].iov_len;
+            setLaunchTime (msgs[n].msg_hdr, &m_pace.control[n * words], nextLaunchTime (octets));
+        }
+    }
+
+    ssize_t len = 0;
+    unsigned sent = 0;
+    while (sent < vlen)
+    {
+        int ret = ::sendmmsg (m_fd, msgs + sent, vlen - sent, MSG_NOSIGNAL);
+        if (ret < 0)
+        {
+            // a batch is sent as a whole. Datagram sockets are rarely full,
+            // so waiting shortly is cheaper than remembering the rest.
+            if (m_nonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                struct pollfd pfd = {m_fd, POLLOUT, 0};
+                if (::poll (&pfd, 1, -1) < 0 && errno != EINTR)
+                    throw errorException (errno);
+                continue;
+            }
+            throw errorException (errno);
+        }
+        for (int n = 0; n < ret; n++)
+            len += msgs[sent + n].msg_len;
+        sent += (unsigned)ret;
+        m_ts.next += (uint32_t)ret;
+        if (calls && ret > 0)
+            (*calls)++;
+    }
+    return len;
+}
+
 ssize_t cSocket::send (const void *buf, size_t len,
     const struct sockaddr *dest_addr, socklen_t addrlen)
 {
+    if (m_uring)
+    {
+        struct iovec iov;
+        iov.iov_base = const_cast<void*>(buf);
+        iov.iov_len  = len;
+        return sendv (&iov, 1, dest_addr, addrlen);
+    }
+
     const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
     ssize_t toBeSent = (ssize_t)len;
     do
@@ -287,6 +622,359 @@ ssize_t cSocket::send (const void *buf, size_t len,
     return len;
 }
 
+ssize_t cSocket::sendv (const struct iovec *iovOrig, int iovcnt,
+    const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+    // partial writes modify the iovecs
+    const int MAX_IOV = 8;
+    BUG_ON (iovcnt > MAX_IOV);
+    struct iovec iov[MAX_IOV];
+    size_t len = 0;
+    for (int n = 0; n < iovcnt; n++)
+    {
+        iov[n] = iovOrig[n];
+        len   += iov[n].iov_len;
+    }
+
+    struct msghdr msg;
+    std::memset (&msg, 0, sizeof (msg));
+    msg.msg_name    = const_cast<struct sockaddr*>(dest_addr);
+    msg.msg_namelen = addrlen;
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = iovcnt;
+
+    union
+    {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE (sizeof (uint64_t))];
+    } control;
+    if (m_pace.txtime)
+        setLaunchTime (msg, &control, nextLaunchTime (len));
+
+    // zerocopy has a per-send overhead (page pinning, notification), which
+    // only pays off for large buffers
+    const size_t ZEROCOPY_MIN = 16 * 1024;
+    int zerocopy = m_zc.enabled && len >= ZEROCOPY_MIN ? MSG_ZEROCOPY : 0;
+
+    ssize_t toBeSent = (ssize_t)len;
+    do
+    {
+        ssize_t ret;
+        // zerocopy completions are reported via the error queue -> always without ring
+        if (m_uring && !zerocopy)
+        {
+            ret = m_uring->sendmsg (&msg, MSG_NOSIGNAL);
+            if (ret == -ECANCELED)
+                throw eventException ();
+            if (ret < 0)
+                throw errorException ((int)-ret);
+        }
+        else
+            ret = ::sendmsg (m_fd, &msg, MSG_NOSIGNAL | zerocopy);
+        if (ret < 0)
+        {
+            // too many pinned pages / pending notifications
+            if (errno == ENOBUFS && zerocopy)
+            {
+                if (m_zc.next != m_zc.completed)
+                    waitZerocopy (m_zc.next - 1);
+                else
+                    zerocopy = 0;
+                continue;
+            }
+            // send buffer is full, the owner waits until the socket is writable again
+            if (m_nonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return (ssize_t)len - toBeSent;
+            throw errorException (errno);
+        }
+        if (zerocopy)
+            m_zc.next++;
+        m_ts.next += m_ts.stream ? (uint32_t)ret : 1;
+        toBeSent -= ret;
+
+        // partial write (stream sockets only), skip what was already sent
+        while (ret > 0 && msg.msg_iovlen)
+        {
+            size_t n = std::min ((size_t)ret, msg.msg_iov->iov_len);
+            msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+            ret -= n;
+            if (!msg.msg_iov->iov_len)
+            {
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+        }
+    } while (toBeSent > 0);
+
+    return len;
+}
+
+bool cSocket::enableZerocopy ()
+{
+    const int enable = 1;
+    if (setsockopt (m_fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)))
+        return false;
+    m_zc.enabled = true;
+
+    // Nagle holds back the last partial segment of a zerocopy send until the
+    // peer acknowledges the rest, which is delayed ACK (~40ms) on loopback.
+    // Ignore errors, not every stream protocol supports it.
+    setsockopt (m_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return true;
+}
+
+void cSocket::waitZerocopy (uint32_t id)
+{
+    BUG_ON (!m_zc.enabled);
+
+    // the error queue is always polled, we are not interested in normal data here
+    struct pollfd pfd[2];
+    pfd[0].fd     = m_fd;
+    pfd[0].events = 0;
+    pfd[1]        = m_pollfd[1];
+
+    reapErrorQueue ();
+    while (!zerocopyDone (id))
+    {
+        int pollret = poll (pfd, 2, m_timeout_ms);
+        if (pollret < 0)
+        {
+            throw errorException (errno);
+        }
+        else if (pollret == 0)
+        {
+            throw errorException ("Zerocopy completion timeout");
+        }
+        if (pfd[1].revents & POLLIN)
+        {
+            throw eventException ();
+        }
+        reapErrorQueue ();
+        if (!zerocopyDone (id) && (pfd[0].revents & POLLHUP))
+        {
+            throw errorException (ECONNRESET);
+        }
+    }
+}
+
+void cSocket::reapErrorQueue ()
+{
+    for (;;)
+    {
+        uint8_t control[CMSG_SPACE (sizeof (struct sock_extended_err) + sizeof (struct sockaddr_in6)) +
+            CMSG_SPACE (3 * sizeof (struct timespec))];
+        struct msghdr msg;
+        std::memset (&msg, 0, sizeof (msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof (control);
+
+        if (::recvmsg (m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            throw errorException (errno);
+        }
+
+        // a TX timestamp comes as SCM_TIMESTAMPING followed by its id in the extended error
+        timestamp ts;
+        rxTimestamp (msg, ts);
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+        {
+            if (!((cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            struct sock_extended_err serr;
+            std::memcpy (&serr, CMSG_DATA (cm), sizeof (serr));
+            if (serr.ee_errno == ENOMSG && serr.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+            {
+                // nobody asks for them if the peer doesn't answer, so limit the queue
+                const size_t MAX_TX_TIMESTAMPS = 4096;
+                if (m_ts.tx.size () >= MAX_TX_TIMESTAMPS)
+                    m_ts.tx.pop_front ();
+                m_ts.tx.push_back (std::make_pair (serr.ee_data, ts));
+                continue;
+            }
+            if (serr.ee_errno != 0 || serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            // range of completed sends [ee_info, ee_data]
+            const uint32_t count = serr.ee_data - serr.ee_info + 1;
+            m_zc.completedSends += count;
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                m_zc.copiedSends += count;
+            if ((int32_t)(serr.ee_data + 1 - m_zc.completed) > 0)
+                m_zc.completed = serr.ee_data + 1;
+        }
+    }
+}
+
+bool cSocket::enableTimestamping (bool hardware)
+{
+    // OPT_ID: TX timestamps carry the id of the octet/datagram, TSONLY: without the sent data
+    int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (hardware)
+        flags |= SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE;
+    if (setsockopt (m_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof (flags)))
+        return false;
+    m_ts.enabled = true;
+    m_ts.stream  = isStream ();
+    m_ts.next    = 0;
+
+    // the ring doesn't return control messages and the error queue
+    delete m_uring;
+    m_uring = nullptr;
+    return true;
+}
+
+bool cSocket::getTxTimestamp (uint32_t id, timestamp& ts)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        while (!m_ts.tx.empty () && (int32_t)(m_ts.tx.front ().first - id) < 0)
+            m_ts.tx.pop_front ();
+        if (!m_ts.tx.empty () && m_ts.tx.front ().first == id)
+        {
+            ts = m_ts.tx.front ().second;
+            m_ts.tx.pop_front ();
+            return true;
+        }
+        if (!attempt)
+            reapErrorQueue ();
+    }
+    return false;
+}
+
+void cSocket::rxTimestamp (const struct msghdr& msg, timestamp& ts)
+{
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (const_cast<struct msghdr*>(&msg), cm))
+    {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING)
+        {
+            // [0] software, [1] deprecated, [2] raw hardware
+            struct timespec stamps[3];
+            std::memcpy (stamps, CMSG_DATA (cm), sizeof (stamps));
+            ts.software = (uint64_t)stamps[0].tv_sec * 1000000000 + stamps[0].tv_nsec;
+            ts.hardware = (uint64_t)stamps[2].tv_sec * 1000000000 + stamps[2].tv_nsec;
+            return;
+        }
+    }
+}
+
+bool cSocket::setIncomingCpu (int cpu)
+{
+    return !setsockopt (m_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof (cpu));
+}
+
+bool cSocket::setPacingRate (uint64_t bytesPerSecond)
+{
+    if (!bytesPerSecond)
+        return false;
+#ifdef SO_TXTIME
+    // precise launch times instead of a rate limit, which fq only applies per flow and packet
+    if (!isStream ())
+    {
+        struct sock_txtime txtime;
+        std::memset (&txtime, 0, sizeof (txtime));
+        txtime.clockid = CLOCK_MONOTONIC;
+        if (!setsockopt (m_fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof (txtime)))
+        {
+            m_pace.rate   = bytesPerSecond;
+            m_pace.txtime = true;
+            m_pace.next   = 0;
+            return true;
+        }
+    }
+#endif
+    // 64 bit since Linux 4.20, 32 bit before
+    if (setsockopt (m_fd, SOL_SOCKET, SO_MAX_PACING_RATE, &bytesPerSecond, sizeof (bytesPerSecond)))
+    {
+        const uint32_t rate = (uint32_t)std::min (bytesPerSecond, (uint64_t)UINT32_MAX - 1);
+        if (setsockopt (m_fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof (rate)))
+            return false;
+    }
+    m_pace.rate = bytesPerSecond;
+    return true;
+}
+
+// SO_TXTIME: sends of len octets are launched back to back at the pacing rate,
+// an idle socket doesn't save up a burst
+uint64_t cSocket::nextLaunchTime (size_t len)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    const uint64_t launch = std::max ((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec, m_pace.next);
+    m_pace.next = launch + (uint64_t)((double)len * 1e9 / m_pace.rate);
+    return launch;
+}
+
+void cSocket::setLaunchTime (struct msghdr& msg, void* control, uint64_t launch)
+{
+#ifdef SO_TXTIME
+    msg.msg_control    = control;
+    msg.msg_controllen = CMSG_SPACE (sizeof (launch));
+    struct cmsghdr* cm = CMSG_FIRSTHDR (&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_TXTIME;
+    cm->cmsg_len   = CMSG_LEN (sizeof (launch));
+    std::memcpy (CMSG_DATA (cm), &launch, sizeof (launch));
+#else
+    (void)msg;
+    (void)control;
+    (void)launch;
+#endif
+}
+
+bool cSocket::supportsUdpSegmentation ()
+{
+    // a segment size of 0 doesn't split anything, but fails on kernels without GSO
+    const int segment = 0;
+    return !setsockopt (m_fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof (segment));
+}
+
+void cSocket::setUdpSegment (struct msghdr& msg, void* control, uint16_t size)
+{
+    msg.msg_control    = control;
+    msg.msg_controllen = GSO_CONTROL_SIZE;
+    struct cmsghdr* cm = CMSG_FIRSTHDR (&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type  = UDP_SEGMENT;
+    cm->cmsg_len   = CMSG_LEN (sizeof (size));
+    std::memcpy (CMSG_DATA (cm), &size, sizeof (size));
+}
+
+bool cSocket::enableUdpGro ()
+{
+    const int enable = 1;
+    return !setsockopt (m_fd, SOL_UDP, UDP_GRO, &enable, sizeof (enable));
+}
+
+unsigned cSocket::groSegments (const struct msghdr& msg, size_t len)
+{
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (const_cast<struct msghdr*>(&msg), cm))
+    {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+        {
+            int segment;
+            std::memcpy (&segment, CMSG_DATA (cm), sizeof (segment));
+            if (segment > 0)
+                return (unsigned)((len + segment - 1) / segment);
+        }
+    }
+    return 1;
+}
+
+bool cSocket::isStream () const
+{
+    int type = 0;
+    socklen_t len = sizeof (type);
+    if (::getsockopt (m_fd, SOL_SOCKET, SO_TYPE, &type, &len))
+        throw errorException (errno);
+    return type == SOCK_STREAM;
+}
+
 void cSocket::getaddrinfo (const std::string& node, uint16_t remotePort,
     int family, int sockType, int protocol, std::list<info>& result)
 {
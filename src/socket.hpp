@@ -22,6 +22,7 @@
 #include <sys/socket.h>
 #include <sys/poll.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
 #include <stdexcept>
@@ -31,10 +32,16 @@
 #include <mutex>
 #include <map>
 #include <cstring>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <utility>
 
 #include "strerror.h"
 #include "event.hpp"
 
+class cUring;
+
 /**
  * TODO this header exposes way too many implementation details and OS dependencies
  * 
@@ -140,14 +147,20 @@ private:
             }
         }
         virtual ~cHandle ()
+        {
+            reset ();
+        }
+        // drops the reference, the descriptor is closed with the last one
+        void reset ()
         {
             if (valid())
             {
                 m_lock.lock();
                 unsigned refs = --m_fdRefs[m_handle];
                 if (!refs)
-                    close (m_handle);
+                    ::close (m_handle);
                 m_lock.unlock();
+                m_handle = -1;
             }
         }
         bool valid () const
@@ -179,17 +192,115 @@ public:
     cSocket& operator= (cSocket&& obj);
     cSocket clone () const;
 
+    enum ioEngine_t
+    {
+        IO_POLL,  // receive directly, poll on socket and cancel event only if there is nothing yet
+        IO_URING  // one io_uring per socket
+    };
+    // I/O engine of all sockets created afterwards, returns false (and keeps
+    // using poll) if it is not supported by the kernel
+    static bool setIoEngine (ioEngine_t engine);
+    // Busy polling of all sockets created afterwards: the kernel polls the device
+    // queue for up to usecs (SO_BUSY_POLL, SO_PREFER_BUSY_POLL) and blocking
+    // receives spin on the socket for as long before they sleep in poll.
+    // A termination request is only noticed after the spin. 0 disables it.
+    static void setBusyPoll (unsigned usecs);
+
     class Properties;
     static cSocket connect (const Properties& properties, const std::string& node,
         uint16_t remotePort, uint16_t localPort);
+    // reusePort: several sockets may listen on the same port (SO_REUSEPORT),
+    // the kernel distributes incoming connections/datagrams among them
     static cSocket listen (const Properties& properties, uint16_t port,
-        int backlog);
+        int backlog, bool reusePort = false);
+    // two connected local sockets (socketpair), type: SOCK_STREAM or SOCK_DGRAM
+    static std::pair<cSocket, cSocket> pair (int type);
 
     cSocket accept (std::string& addr, uint16_t& port);
     ssize_t recv (void *buf, size_t len, size_t atleast = 0,
         struct sockaddr * src_addr = nullptr, socklen_t * addrlen = nullptr);
     ssize_t send (const void *buf, size_t len,
         const struct sockaddr *dest_addr = nullptr, socklen_t addrlen = 0);
+    // gather send, data of all buffers is sent as one unit. Non-blocking sockets
+    // return the number of sent octets instead (maybe 0) if the send buffer is full.
+    ssize_t sendv (const struct iovec *iov, int iovcnt,
+        const struct sockaddr *dest_addr = nullptr, socklen_t addrlen = 0);
+    // scatter receive, returns after one successful read (0 if there was nothing to read)
+    // segments: number of datagrams on the wire (> 1 if they were coalesced by UDP GRO)
+    ssize_t recvv (const struct iovec *iov, int iovcnt,
+        struct sockaddr * src_addr = nullptr, socklen_t * addrlen = nullptr, unsigned* segments = nullptr);
+    // stream sockets with io_uring only: receive without copying. data points to
+    // the received octets in the buffer ring of the io_uring. The buffer goes back
+    // to the kernel, when releaseInPlace has been called for all of them.
+    bool canRecvInPlace () const;
+    ssize_t recvInPlace (const uint8_t*& data, void* scratch, size_t len);
+    void releaseInPlace (size_t len);
+    // receive up to vlen datagrams with one call, returns the number of received datagrams
+    int recvmmsg (struct mmsghdr *msgs, unsigned vlen);
+    // send all vlen datagrams, returns the number of sent octets
+    // calls: incremented by the number of sendmmsg system calls which sent datagrams
+    ssize_t sendmmsg (struct mmsghdr *msgs, unsigned vlen, unsigned* calls = nullptr);
+    // byte stream socket, i.e. message boundaries are not preserved
+    bool isStream () const;
+
+    // UDP generic segmentation offload: true if the socket supports it. Only
+    // sends with a segment size (setUdpSegment) are split by the kernel (or NIC).
+    bool supportsUdpSegmentation ();
+    // control buffer size needed by setUdpSegment
+    static const size_t GSO_CONTROL_SIZE = CMSG_SPACE (sizeof (uint16_t));
+    // the send of msg is split into datagrams of size octets (the last one may be shorter)
+    static void setUdpSegment (struct msghdr& msg, void* control, uint16_t size);
+    // UDP generic receive offload: consecutive datagrams may be received as one
+    bool enableUdpGro ();
+    // control buffer size needed by recvmmsg to get the GRO segment size
+    static const size_t GRO_CONTROL_SIZE = CMSG_SPACE (sizeof (int));
+    // ... and the receive timestamp
+    static const size_t RX_CONTROL_SIZE = GRO_CONTROL_SIZE + CMSG_SPACE (3 * sizeof (struct timespec));
+    // number of datagrams within a received GRO buffer
+    static unsigned groSegments (const struct msghdr& msg, size_t len);
+
+    // within a SO_REUSEPORT group, prefer this socket for connections/datagrams
+    // processed by cpu, returns false if not supported
+    bool setIncomingCpu (int cpu);
+
+    // SO_TIMESTAMPING, in nanoseconds, 0 if not available
+    struct timestamp
+    {
+        timestamp () : software (0), hardware (0) {}
+        uint64_t software; // CLOCK_REALTIME of the kernel
+        uint64_t hardware; // clock of the NIC
+    };
+    // Kernel timestamps of all sent and received data. Hardware timestamps are
+    // only reported if the NIC has been configured for them (e.g. with
+    // hwstamp_ctl). Returns false if not supported, disables the ring.
+    bool enableTimestamping (bool hardware);
+    bool isTimestamping () const {return m_ts.enabled;}
+    // timestamp of the last receive call which returned data
+    const timestamp& getRxTimestamp () const {return m_ts.rx;}
+    // the kernel numbers sent octets (stream) or datagrams (send calls), this is
+    // the id of the next one. A send is timestamped with the id of its last octet.
+    uint32_t nextTxTimestampId () const {return m_ts.next;}
+    // TX timestamp of id from the error queue, false if it was not (yet) reported.
+    // Timestamps of older ids are discarded.
+    bool getTxTimestamp (uint32_t id, timestamp& ts);
+    // RX timestamp of a message received with recvmmsg
+    static void rxTimestamp (const struct msghdr& msg, timestamp& ts);
+
+    // Pacing by the kernel, bytesPerSecond of sent data. Stream sockets use
+    // SO_MAX_PACING_RATE, datagram sockets get a launch time per send (SO_TXTIME),
+    // which is only honored by the fq qdisc. Returns false if not supported.
+    bool setPacingRate (uint64_t bytesPerSecond);
+    uint64_t getPacingRate () const {return m_pace.rate;}
+
+    // send large buffers with MSG_ZEROCOPY, returns false if not supported
+    bool enableZerocopy ();
+    // id of the next zerocopy send, ids are assigned by the kernel in send order
+    uint32_t nextZerocopyId () const {return m_zc.next;}
+    // block until the kernel doesn't reference the buffers of zerocopy send 'id' any more
+    void waitZerocopy (uint32_t id);
+    // completed zerocopy sends and how many of them were copied nevertheless
+    uint64_t getZerocopyCompleted () const {return m_zc.completedSends;}
+    uint64_t getZerocopyCopied () const {return m_zc.copiedSends;}
 
     // get local address and port of socket
     std::string getsockname ();
@@ -198,13 +309,33 @@ public:
     static std::string inet_ntop (const struct sockaddr* addr);
     void setCancelEvent (cEvent& eventCancel);
     bool isValid () const {return m_fd.valid();}
+    // closes the connection, but keeps the object (and e.g. its zerocopy counters).
+    // Any further I/O fails with EBADF.
+    void close ();
+
+    // for sockets driven by an event loop: receive and send never wait,
+    // the owner waits for readiness (e.g. with epoll on nativeHandle)
+    void setNonBlocking ();
+    bool isNonBlocking () const {return m_nonBlocking;}
+    int nativeHandle () const {return m_fd;}
 
 private:
     cSocket ();
     cSocket (int domain, int type, int protocol, int timeout = -1);
     cSocket (int fd, int timeout);
     void initPoll (int evfd);
+    void initEngine ();
     void enableOption (int level, int optname);
+    bool pollIn ();
+    bool isCancelled () const {return m_cancel && m_cancel->isSignaled ();}
+    template <typename F> auto tryRecv (F recv) -> decltype (recv ());
+    void reapErrorQueue ();
+    uint64_t nextLaunchTime (size_t len);
+    static void setLaunchTime (struct msghdr& msg, void* control, uint64_t launch);
+    bool zerocopyDone (uint32_t id) const
+    {
+        return (int32_t)(m_zc.completed - id) > 0;
+    }
     struct info
     {
         info (const struct addrinfo& info)
@@ -230,7 +361,40 @@ private:
     cHandle m_fd;
     struct pollfd m_pollfd[2]; // 0: socket fd, 1: event fd
     int m_timeout_ms;
+    cUring* m_uring;           // nullptr with IO_POLL
+    bool m_nonBlocking;
+    const cEvent* m_cancel;    // checked before each receive, nullptr if none
+    static ioEngine_t m_ioEngine;
+    static unsigned   m_busyPollUs;
 
+    struct zerocopy
+    {
+        zerocopy () : enabled (false), next (0), completed (0), completedSends (0), copiedSends (0) {}
+        bool     enabled;
+        uint32_t next;           // id of the next MSG_ZEROCOPY send
+        uint32_t completed;      // all ids before this one are completed
+        uint64_t completedSends;
+        uint64_t copiedSends;    // kernel fell back to copying (e.g. loopback)
+    } m_zc;
+
+    struct timestamping
+    {
+        timestamping () : enabled (false), stream (false), next (0) {}
+        bool      enabled;
+        bool      stream;        // ids count octets, not datagrams
+        uint32_t  next;          // id of the next sent octet/datagram
+        timestamp rx;
+        std::deque<std::pair<uint32_t, timestamp>> tx; // reported, not yet taken
+    } m_ts;
+
+    struct pacing
+    {
+        pacing () : rate (0), txtime (false), next (0) {}
+        uint64_t rate;           // octets per second, 0: not paced
+        bool     txtime;         // SO_TXTIME launch times instead of SO_MAX_PACING_RATE
+        uint64_t next;           // earliest launch time of the next send (CLOCK_MONOTONIC, ns)
+        std::vector<uint64_t> control; // control buffers of sendmmsg
+    } m_pace;
 };
 
 
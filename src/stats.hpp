@@ -21,11 +21,17 @@
 
 #include <cstdint>
 #include <cinttypes>
+#include <atomic>
+
+#include "latency.hpp"
 
 class cStats
 {
 public:
-    cStats () : m_sentPackets(0), m_sentOctets(0), m_receivedPackets(0), m_receivedOctets(0), m_errors(0), m_timeouts(0)
+    cStats () : m_sentPackets(0), m_sentOctets(0), m_receivedPackets(0), m_receivedOctets(0), m_errors(0), m_timeouts(0),
+        m_verifiedPackets(0), m_verifiedOctets(0), m_zerocopySends(0), m_zerocopyCopied(0),
+        m_sendCalls(0), m_recvCalls(0), m_sentSegments(0), m_receivedSegments(0),
+        m_clockOffset(0), m_clockOffsetDelay(0), m_pacingRate(0)
     {
     }
 
@@ -38,6 +44,32 @@ public:
         result.m_receivedOctets  = m_receivedOctets  + val.m_receivedOctets;
         result.m_errors          = m_errors          + val.m_errors;
         result.m_timeouts        = m_timeouts        + val.m_timeouts;
+        result.m_verifiedPackets = m_verifiedPackets + val.m_verifiedPackets;
+        result.m_verifiedOctets  = m_verifiedOctets  + val.m_verifiedOctets;
+        result.m_zerocopySends   = m_zerocopySends   + val.m_zerocopySends;
+        result.m_zerocopyCopied  = m_zerocopyCopied  + val.m_zerocopyCopied;
+        result.m_sendCalls       = m_sendCalls       + val.m_sendCalls;
+        result.m_recvCalls       = m_recvCalls       + val.m_recvCalls;
+        result.m_sentSegments    = m_sentSegments    + val.m_sentSegments;
+        result.m_receivedSegments = m_receivedSegments + val.m_receivedSegments;
+        result.m_latency          = m_latency;
+        result.m_latency         += val.m_latency;
+        result.m_kernelLatency    = m_kernelLatency;
+        result.m_kernelLatency   += val.m_kernelLatency;
+        result.m_nicLatency       = m_nicLatency;
+        result.m_nicLatency      += val.m_nicLatency;
+        result.m_hostLatency      = m_hostLatency;
+        result.m_hostLatency     += val.m_hostLatency;
+        result.m_requestPath      = m_requestPath;
+        result.m_requestPath     += val.m_requestPath;
+        result.m_serverTime       = m_serverTime;
+        result.m_serverTime      += val.m_serverTime;
+        result.m_responsePath     = m_responsePath;
+        result.m_responsePath    += val.m_responsePath;
+        result.m_sendLag          = m_sendLag;
+        result.m_sendLag         += val.m_sendLag;
+        result.mergeClockOffset (*this, val);
+        result.m_pacingRate       = m_pacingRate + val.m_pacingRate;
         return result;
     }
     cStats operator- (const cStats& val) const
@@ -49,6 +81,34 @@ public:
         result.m_receivedOctets  = m_receivedOctets  - val.m_receivedOctets;
         result.m_errors          = m_errors          - val.m_errors;
         result.m_timeouts        = m_timeouts        - val.m_timeouts;
+        result.m_verifiedPackets = m_verifiedPackets - val.m_verifiedPackets;
+        result.m_verifiedOctets  = m_verifiedOctets  - val.m_verifiedOctets;
+        result.m_zerocopySends   = m_zerocopySends   - val.m_zerocopySends;
+        result.m_zerocopyCopied  = m_zerocopyCopied  - val.m_zerocopyCopied;
+        result.m_sendCalls       = m_sendCalls       - val.m_sendCalls;
+        result.m_recvCalls       = m_recvCalls       - val.m_recvCalls;
+        result.m_sentSegments    = m_sentSegments    - val.m_sentSegments;
+        result.m_receivedSegments = m_receivedSegments - val.m_receivedSegments;
+        result.m_latency          = m_latency;
+        result.m_latency         -= val.m_latency;
+        result.m_kernelLatency    = m_kernelLatency;
+        result.m_kernelLatency   -= val.m_kernelLatency;
+        result.m_nicLatency       = m_nicLatency;
+        result.m_nicLatency      -= val.m_nicLatency;
+        result.m_hostLatency      = m_hostLatency;
+        result.m_hostLatency     -= val.m_hostLatency;
+        result.m_requestPath      = m_requestPath;
+        result.m_requestPath     -= val.m_requestPath;
+        result.m_serverTime       = m_serverTime;
+        result.m_serverTime      -= val.m_serverTime;
+        result.m_responsePath     = m_responsePath;
+        result.m_responsePath    -= val.m_responsePath;
+        result.m_sendLag          = m_sendLag;
+        result.m_sendLag         -= val.m_sendLag;
+        // an estimate, not a counter
+        result.m_clockOffset      = m_clockOffset;
+        result.m_clockOffsetDelay = m_clockOffsetDelay;
+        result.m_pacingRate       = m_pacingRate;
         return result;
     }
     cStats& operator+= (const cStats& val)
@@ -59,6 +119,24 @@ public:
         m_receivedOctets  += val.m_receivedOctets;
         m_errors          += val.m_errors;
         m_timeouts        += val.m_timeouts;
+        m_verifiedPackets += val.m_verifiedPackets;
+        m_verifiedOctets  += val.m_verifiedOctets;
+        m_zerocopySends   += val.m_zerocopySends;
+        m_zerocopyCopied  += val.m_zerocopyCopied;
+        m_sendCalls       += val.m_sendCalls;
+        m_recvCalls       += val.m_recvCalls;
+        m_sentSegments    += val.m_sentSegments;
+        m_receivedSegments += val.m_receivedSegments;
+        m_latency         += val.m_latency;
+        m_kernelLatency   += val.m_kernelLatency;
+        m_nicLatency      += val.m_nicLatency;
+        m_hostLatency     += val.m_hostLatency;
+        m_requestPath     += val.m_requestPath;
+        m_serverTime      += val.m_serverTime;
+        m_responsePath    += val.m_responsePath;
+        m_sendLag         += val.m_sendLag;
+        mergeClockOffset (*this, val);
+        m_pacingRate      += val.m_pacingRate;
         return *this;
     }
     cStats& operator-= (const cStats& val)
@@ -69,6 +147,22 @@ public:
         m_receivedOctets  -= val.m_receivedOctets;
         m_errors          -= val.m_errors;
         m_timeouts        -= val.m_timeouts;
+        m_verifiedPackets -= val.m_verifiedPackets;
+        m_verifiedOctets  -= val.m_verifiedOctets;
+        m_zerocopySends   -= val.m_zerocopySends;
+        m_zerocopyCopied  -= val.m_zerocopyCopied;
+        m_sendCalls       -= val.m_sendCalls;
+        m_recvCalls       -= val.m_recvCalls;
+        m_sentSegments    -= val.m_sentSegments;
+        m_receivedSegments -= val.m_receivedSegments;
+        m_latency         -= val.m_latency;
+        m_kernelLatency   -= val.m_kernelLatency;
+        m_nicLatency      -= val.m_nicLatency;
+        m_hostLatency     -= val.m_hostLatency;
+        m_requestPath     -= val.m_requestPath;
+        m_serverTime      -= val.m_serverTime;
+        m_responsePath    -= val.m_responsePath;
+        m_sendLag         -= val.m_sendLag;
         return *this;
     }
 
@@ -78,6 +172,135 @@ public:
     int_fast64_t m_receivedOctets;
     int_fast64_t m_errors;
     int_fast64_t m_timeouts;
+    int_fast64_t m_verifiedPackets; // messages with verified payload
+    int_fast64_t m_verifiedOctets;  // verified payload octets
+    int_fast64_t m_zerocopySends;   // completed MSG_ZEROCOPY sends
+    int_fast64_t m_zerocopyCopied;  // ... where the kernel copied the data anyway
+    int_fast64_t m_sendCalls;       // send system calls
+    int_fast64_t m_recvCalls;       // receive system calls which returned data
+    int_fast64_t m_sentSegments;    // datagrams on the wire (more than send calls with UDP GSO)
+    int_fast64_t m_receivedSegments;// datagrams on the wire (more than receive calls with UDP GRO)
+    cLatencyHistogram m_latency;    // round trip times (clients only)
+    cLatencyHistogram m_kernelLatency; // ... from kernel TX to kernel RX timestamp
+    cLatencyHistogram m_nicLatency;    // ... from NIC TX to NIC RX timestamp
+    cLatencyHistogram m_hostLatency;   // ... user space minus kernel round trip time
+    cLatencyHistogram m_requestPath;   // one-way delay client -> server (header timestamps)
+    cLatencyHistogram m_serverTime;    // time between receiving the request and sending the response
+    cLatencyHistogram m_responsePath;  // one-way delay server -> client
+    cLatencyHistogram m_sendLag;       // open loop: actual minus scheduled send time
+    int_fast64_t m_clockOffset;     // server clock - client clock in ns
+    uint64_t     m_clockOffsetDelay;// round trip delay of the sample m_clockOffset is based on, 0: no estimate
+    int_fast64_t m_pacingRate;      // requested kernel pacing in octets/s (a rate, not a counter)
+
+private:
+    // the estimate of the fastest round trip is the most accurate one
+    void mergeClockOffset (const cStats& a, const cStats& b)
+    {
+        const cStats& best = !b.m_clockOffsetDelay ||
+            (a.m_clockOffsetDelay && a.m_clockOffsetDelay <= b.m_clockOffsetDelay) ? a : b;
+        m_clockOffset      = best.m_clockOffset;
+        m_clockOffsetDelay = best.m_clockOffsetDelay;
+    }
+};
+
+/**
+ * The counters of cStats with a single writer (the I/O thread) and any number
+ * of readers.
+ *
+ * Updates are protected by a sequence counter (seqlock), so the writer never
+ * waits and doesn't need any locked instruction. Readers retry until they got
+ * a snapshot which was not modified while copying it. The counters are atomics
+ * accessed with relaxed loads and stores, so readers racing with the writer
+ * are well-defined and cheap (plain moves on 64-bit targets).
+ * The latency histograms are not part of it, see cSharedLatencyHistogram.
+ */
+class cSharedStats
+{
+public:
+    class cCounter
+    {
+    public:
+        cCounter () : m_value (0) {}
+        // writer only
+        cCounter& operator+= (int_fast64_t val)
+        {
+            m_value.store (m_value.load (std::memory_order_relaxed) + val, std::memory_order_relaxed);
+            return *this;
+        }
+        cCounter& operator= (int_fast64_t val)
+        {
+            m_value.store (val, std::memory_order_relaxed);
+            return *this;
+        }
+        int_fast64_t get () const
+        {
+            return m_value.load (std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<int_fast64_t> m_value;
+    };
+
+    cSharedStats () : m_seq (0)
+    {
+    }
+
+    // writer only: modify the counters between beginUpdate and endUpdate
+    void beginUpdate ()
+    {
+        m_seq.store (m_seq.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+    }
+    void endUpdate ()
+    {
+        m_seq.store (m_seq.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consistent snapshot of the counters, can be called by any thread.
+    // The other members of stats are not touched.
+    void read (cStats& stats) const
+    {
+        unsigned seq1, seq2;
+        do
+        {
+            seq1 = m_seq.load (std::memory_order_acquire);
+            stats.m_sentPackets      = m_sentPackets.get ();
+            stats.m_sentOctets       = m_sentOctets.get ();
+            stats.m_receivedPackets  = m_receivedPackets.get ();
+            stats.m_receivedOctets   = m_receivedOctets.get ();
+            stats.m_errors           = m_errors.get ();
+            stats.m_timeouts         = m_timeouts.get ();
+            stats.m_verifiedPackets  = m_verifiedPackets.get ();
+            stats.m_verifiedOctets   = m_verifiedOctets.get ();
+            stats.m_zerocopySends    = m_zerocopySends.get ();
+            stats.m_zerocopyCopied   = m_zerocopyCopied.get ();
+            stats.m_sendCalls        = m_sendCalls.get ();
+            stats.m_recvCalls        = m_recvCalls.get ();
+            stats.m_sentSegments     = m_sentSegments.get ();
+            stats.m_receivedSegments = m_receivedSegments.get ();
+            std::atomic_thread_fence (std::memory_order_acquire);
+            seq2 = m_seq.load (std::memory_order_relaxed);
+        } while (seq1 != seq2 || (seq1 & 1));
+    }
+
+    // see cStats, the writer can read them without synchronization
+    cCounter m_sentPackets;
+    cCounter m_sentOctets;
+    cCounter m_receivedPackets;
+    cCounter m_receivedOctets;
+    cCounter m_errors;
+    cCounter m_timeouts;
+    cCounter m_verifiedPackets;
+    cCounter m_verifiedOctets;
+    cCounter m_zerocopySends;
+    cCounter m_zerocopyCopied;
+    cCounter m_sendCalls;
+    cCounter m_recvCalls;
+    cCounter m_sentSegments;
+    cCounter m_receivedSegments;
+
+private:
+    std::atomic<unsigned> m_seq; // odd while an update is in progress
 };
 
 
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TOKENBUCKET_HPP
+#define TOKENBUCKET_HPP
+
+#include <cstdint>
+#include <cmath>
+#include <ratio>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+
+/**
+ * Token bucket shared by all connections, e.g. bytes or requests per second.
+ *
+ * The whole state is one virtual time (like GCRA): the point in time at which
+ * the bucket has refilled all tokens taken so far. A full bucket is a virtual
+ * time burst tokens in the past. Taking tokens advances it with a single
+ * fetch_add, so the bucket is lock-free and never retries under load. Only
+ * after an idle time, the tokens beyond the burst are dropped with a CAS.
+ * Tokens are reserved, not tried: if the virtual time ends up in the future,
+ * the caller must wait until then, but keeps its place. So all callers
+ * together never get more than rate * t + burst tokens.
+ * The virtual time counts picoseconds since construction, the rounding of
+ * each acquisition doesn't add up even at millions of them per second.
+ */
+class cTokenBucket
+{
+public:
+    cTokenBucket (const cTokenBucket&) = delete;
+    cTokenBucket& operator=(const cTokenBucket&) = delete;
+
+    // rate: tokens per second, burst: tokens of a full bucket (at least 1)
+    cTokenBucket (double rate, double burst)
+        : m_epoch (std::chrono::steady_clock::now ()),
+          m_psPerToken (1e12 / rate),
+          m_burst ((int64_t)std::llround (std::max (burst, 1.0) * m_psPerToken)),
+          m_tat (-m_burst)
+    {
+    }
+
+    // takes tokens, returns the time from which on they may be used
+    // (in the past, if they were available)
+    std::chrono::steady_clock::time_point acquire (uint64_t tokens)
+    {
+        const int64_t full = picoseconds (std::chrono::steady_clock::now ()) - m_burst;
+        int64_t tat = m_tat.load (std::memory_order_relaxed);
+        while (tat < full && !m_tat.compare_exchange_weak (tat, full, std::memory_order_relaxed))
+            ;
+
+        const int64_t cost  = (int64_t)std::llround ((double)tokens * m_psPerToken);
+        const int64_t ready = m_tat.fetch_add (cost, std::memory_order_relaxed) + cost;
+        return m_epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<int64_t, std::pico> (ready));
+    }
+
+private:
+    int64_t picoseconds (std::chrono::steady_clock::time_point t) const
+    {
+        return std::chrono::duration_cast<std::chrono::duration<int64_t, std::pico>>(t - m_epoch).count ();
+    }
+
+    const std::chrono::steady_clock::time_point m_epoch;
+    const double  m_psPerToken;
+    const int64_t m_burst;       // in picoseconds
+    std::atomic<int64_t> m_tat;  // virtual time, picoseconds since m_epoch
+};
+
+#endif
@@ -0,0 +1,595 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#include "uring.hpp"
+#include "bug.hpp"
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+// there is no libc wrapper and we don't want to depend on liburing
+static int io_uring_setup (unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall (__NR_io_uring_setup, entries, p);
+}
+static int io_uring_enter (int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return (int)syscall (__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+static int io_uring_register (int fd, unsigned opcode, const void* arg, unsigned nrArgs)
+{
+    return (int)syscall (__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+// at most one single shot request, the multishot recv and the cancel poll are pending
+static const unsigned RING_ENTRIES = 8;
+
+
+cUring::cUring (int ringfd, bool stream)
+    : m_fd (ringfd), m_stream (stream),
+      m_sqRing (nullptr), m_sqRingSize (0), m_cqRing (nullptr), m_cqRingSize (0),
+      m_sqes (nullptr), m_sqesSize (0), m_sqHead (nullptr), m_sqTail (nullptr),
+      m_sqMask (0), m_sqEntries (0), m_sqArray (nullptr), m_cqHead (nullptr),
+      m_cqTail (nullptr), m_cqMask (0), m_cqes (nullptr), m_toSubmit (0),
+      m_ioDone (true), m_ioResult (0), m_recvArmed (false), m_cancelArmed (false),
+      m_cancelled (false), m_hasCancelEvent (false),
+      m_bufRing (nullptr), m_bufRingSize (0), m_rxBuffers (nullptr), m_noMultishot (false),
+      m_inPlace (false)
+{
+}
+
+cUring::~cUring ()
+{
+    // the kernel must not write into the buffers any more when they are freed
+    if (m_sqes)
+    {
+        if (m_recvArmed)
+            cancel (ID_RECV);
+        if (m_cancelArmed)
+            cancel (ID_CANCEL);
+    }
+    close (m_fd);
+
+    if (m_sqes)
+        munmap (m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing)
+        munmap (m_cqRing, m_cqRingSize);
+    if (m_sqRing)
+        munmap (m_sqRing, m_sqRingSize);
+    if (m_bufRing)
+        munmap (m_bufRing, m_bufRingSize);
+    delete[] m_rxBuffers;
+}
+
+cUring* cUring::create (int sockfd)
+{
+    int type = 0;
+    socklen_t len = sizeof (type);
+    if (::getsockopt (sockfd, SOL_SOCKET, SO_TYPE, &type, &len))
+        return nullptr;
+
+    struct io_uring_params p;
+    std::memset (&p, 0, sizeof (p));
+    // completions are only needed when we are waiting for them anyway
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    int fd  = io_uring_setup (RING_ENTRIES, &p);
+    if (fd < 0 && errno == EINVAL)
+    {
+        std::memset (&p, 0, sizeof (p));
+        fd = io_uring_setup (RING_ENTRIES, &p);
+    }
+    if (fd < 0)
+        return nullptr;
+
+    cUring* ring = new cUring (fd, type == SOCK_STREAM);
+    if (!ring->init (sockfd, p))
+    {
+        delete ring;
+        return nullptr;
+    }
+    return ring;
+}
+
+bool cUring::isSupported ()
+{
+    struct io_uring_params p;
+    std::memset (&p, 0, sizeof (p));
+    int fd = io_uring_setup (1, &p);
+    if (fd < 0)
+        return false;
+    close (fd);
+    return true;
+}
+
+bool cUring::init (int sockfd, const struct io_uring_params& p)
+{
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    m_cqRingSize = p.cq_off.cqes  + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_sqRingSize = m_cqRingSize = std::max (m_sqRingSize, m_cqRingSize);
+
+    void* ptr = mmap (nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        m_fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED)
+        return false;
+    m_sqRing = ptr;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        m_cqRing = m_sqRing;
+    else
+    {
+        ptr = mmap (nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED)
+            return false;
+        m_cqRing = ptr;
+    }
+
+    m_sqesSize = p.sq_entries * sizeof (struct io_uring_sqe);
+    ptr = mmap (nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        m_fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED)
+        return false;
+    m_sqes = (struct io_uring_sqe*)ptr;
+
+    uint8_t* sq = (uint8_t*)m_sqRing;
+    uint8_t* cq = (uint8_t*)m_cqRing;
+    m_sqHead    = (unsigned*)(sq + p.sq_off.head);
+    m_sqTail    = (unsigned*)(sq + p.sq_off.tail);
+    m_sqMask    = *(unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    m_sqArray   = (unsigned*)(sq + p.sq_off.array);
+    m_cqHead    = (unsigned*)(cq + p.cq_off.head);
+    m_cqTail    = (unsigned*)(cq + p.cq_off.tail);
+    m_cqMask    = *(unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes      = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // the slot of the cancel event stays empty until it is known
+    const int files[2] = {sockfd, -1};
+    return !io_uring_register (m_fd, IORING_REGISTER_FILES, files, 2);
+}
+
+bool cUring::initBufRing ()
+{
+    if (m_noMultishot)
+        return false;
+
+    // the ring must be page aligned
+    m_bufRingSize = RX_BUFFERS * sizeof (struct io_uring_buf);
+    void* ptr = mmap (nullptr, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        m_noMultishot = true;
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    std::memset (&reg, 0, sizeof (reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)ptr;
+    reg.ring_entries = RX_BUFFERS;
+    reg.bgid         = RX_GROUP;
+    if (io_uring_register (m_fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+    {
+        munmap (ptr, m_bufRingSize);
+        m_noMultishot = true;
+        return false;
+    }
+
+    m_bufRing   = (struct io_uring_buf_ring*)ptr;
+    m_rxBuffers = new uint8_t[RX_BUFFERS * RX_BUFFER_LEN];
+    for (unsigned bid = 0; bid < RX_BUFFERS; bid++)
+        recycle ((uint16_t)bid);
+    return true;
+}
+
+bool cUring::setCancelEvent (int evfd)
+{
+    struct io_uring_files_update update;
+    std::memset (&update, 0, sizeof (update));
+    update.offset = FILE_CANCEL;
+    update.fds    = (uint64_t)(uintptr_t)&evfd;
+    m_hasCancelEvent = io_uring_register (m_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+    return m_hasCancelEvent;
+}
+
+// the kernel reads the SQEs during io_uring_enter only, so they can be filled
+// after they were added to the ring
+struct io_uring_sqe* cUring::getSqe (uint64_t id)
+{
+    unsigned tail = *m_sqTail;
+    if (tail - __atomic_load_n (m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+    {
+        enter (0);
+        BUG_ON (tail - __atomic_load_n (m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries);
+    }
+
+    struct io_uring_sqe* sqe = &m_sqes[tail & m_sqMask];
+    std::memset (sqe, 0, sizeof (*sqe));
+    sqe->user_data = id;
+    m_sqArray[tail & m_sqMask] = tail & m_sqMask;
+    __atomic_store_n (m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    m_toSubmit++;
+    return sqe;
+}
+
+// submits all prepared SQEs and waits for minComplete completions
+void cUring::enter (unsigned minComplete)
+{
+    for (;;)
+    {
+        int ret = io_uring_enter (m_fd, m_toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0);
+        if (ret >= 0)
+        {
+            m_toSubmit -= std::min ((unsigned)ret, m_toSubmit);
+            return;
+        }
+        // completion ring is full, make room
+        if (errno == EAGAIN || errno == EBUSY)
+            reap ();
+        else
+            BUG_ON (errno != EINTR);
+    }
+}
+
+void cUring::reap ()
+{
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n (m_cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        const struct io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+        switch (cqe.user_data)
+        {
+        case ID_IO:
+            m_ioDone   = true;
+            m_ioResult = cqe.res;
+            break;
+        case ID_RECV:
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+                m_recvArmed = false;
+            if (cqe.res > 0)
+                m_rxChunks.push_back ({cqe.res, (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT), 0});
+            else if (cqe.res == -EINVAL && m_rxChunks.empty ())
+                m_noMultishot = true; // kernel < 6.0, nothing was received so far
+            else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+                m_rxChunks.push_back ({cqe.res, 0, 0});
+            // -ENOBUFS: all buffers are still queued, re-armed when they are consumed
+            break;
+        case ID_CANCEL:
+            m_cancelArmed = false;
+            if (cqe.res >= 0)
+                m_cancelled = true;
+            break;
+        }
+    }
+    __atomic_store_n (m_cqHead, head, __ATOMIC_RELEASE);
+}
+
+bool cUring::isPending (uint64_t id) const
+{
+    switch (id)
+    {
+    case ID_IO:
+        return !m_ioDone;
+    case ID_RECV:
+        return m_recvArmed;
+    case ID_CANCEL:
+        return m_cancelArmed;
+    }
+    return false;
+}
+
+// cancels a pending request and waits for its last completion
+void cUring::cancel (uint64_t id)
+{
+    struct io_uring_sqe* sqe = getSqe (ID_ASYNC_CANCEL);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr   = id;
+
+    while (isPending (id))
+    {
+        enter (1);
+        reap ();
+    }
+}
+
+void cUring::armCancel ()
+{
+    if (!m_hasCancelEvent || m_cancelArmed || m_cancelled)
+        return;
+
+    uint32_t events = POLLIN;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = (events << 16) | (events >> 16);
+#endif
+    struct io_uring_sqe* sqe = getSqe (ID_CANCEL);
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = FILE_CANCEL;
+    sqe->flags         = IOSQE_FIXED_FILE;
+    sqe->poll32_events = events;
+    m_cancelArmed = true;
+}
+
+void cUring::armRecv ()
+{
+    struct io_uring_sqe* sqe = getSqe (ID_RECV);
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = FILE_SOCKET;
+    sqe->flags     = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RX_GROUP;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    m_recvArmed = true;
+}
+
+void cUring::recycle (uint16_t bid)
+{
+    // The tail overlays the reserved field of the first buffer. The flexible
+    // array of io_uring_buf_ring is not at offset 0 in C++, so don't use it.
+    const uint16_t tail = m_bufRing->tail;
+    struct io_uring_buf& buf = reinterpret_cast<struct io_uring_buf*>(m_bufRing)[tail & (RX_BUFFERS - 1)];
+    buf.addr = (uint64_t)(uintptr_t)(m_rxBuffers + (size_t)bid * RX_BUFFER_LEN);
+    buf.len  = RX_BUFFER_LEN;
+    buf.bid  = bid;
+    __atomic_store_n (&m_bufRing->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+// executes the prepared ID_IO request
+int cUring::execute ()
+{
+    armCancel ();
+    m_ioDone = false;
+    while (!m_ioDone)
+    {
+        enter (1);
+        reap ();
+        if (m_cancelled && !m_ioDone)
+        {
+            // the request references buffers of the caller
+            cancel (ID_IO);
+            return -ECANCELED;
+        }
+    }
+    return m_ioResult;
+}
+
+// waits for a completion of the multishot recv. Returns 1 if there is a chunk,
+// 0 if multishot recv is not supported (-> recvSingle) or -ECANCELED.
+int cUring::waitChunk ()
+{
+    if (!m_stream || (!m_bufRing && !initBufRing ()))
+        return 0;
+
+    for (;;)
+    {
+        reap ();
+        if (m_cancelled)
+            return -ECANCELED;
+        if (m_noMultishot)
+            return 0;
+        if (!m_rxChunks.empty ())
+            return 1;
+
+        if (!m_recvArmed)
+            armRecv ();
+        armCancel ();
+        enter (1);
+    }
+}
+
+// the buffer of the front chunk goes back to the kernel once it is consumed
+void cUring::consume (size_t len)
+{
+    cChunk& chunk = m_rxChunks.front ();
+    chunk.offset += (unsigned)len;
+    if (chunk.offset == (unsigned)chunk.res)
+    {
+        recycle (chunk.bid);
+        m_rxChunks.pop_front ();
+        m_inPlace = false;
+    }
+}
+
+ssize_t cUring::recv (const struct iovec *iov, int iovcnt)
+{
+    int ret = waitChunk ();
+    if (ret <= 0)
+        return ret ? ret : recvSingle (iov, iovcnt);
+
+    cChunk& chunk = m_rxChunks.front ();
+    if (chunk.res <= 0)
+    {
+        ret = chunk.res;
+        m_rxChunks.pop_front ();
+        return ret;
+    }
+
+    const uint8_t* p = m_rxBuffers + (size_t)chunk.bid * RX_BUFFER_LEN + chunk.offset;
+    size_t copied = 0;
+    for (int n = 0; n < iovcnt && copied < (size_t)chunk.res - chunk.offset; n++)
+    {
+        size_t len = std::min (iov[n].iov_len, (size_t)chunk.res - chunk.offset - copied);
+        std::memcpy (iov[n].iov_base, p + copied, len);
+        copied += len;
+    }
+    consume (copied);
+    return copied;
+}
+
+ssize_t cUring::recvInPlace (const uint8_t*& data, void* scratch, size_t len)
+{
+    // the previous chunk must have been consumed completely
+    BUG_ON (m_inPlace);
+
+    int ret = waitChunk ();
+    if (ret <= 0)
+    {
+        if (ret)
+            return ret;
+        struct iovec iov = {scratch, len};
+        data = (const uint8_t*)scratch;
+        return recvSingle (&iov, 1);
+    }
+
+    cChunk& chunk = m_rxChunks.front ();
+    if (chunk.res <= 0)
+    {
+        ret = chunk.res;
+        m_rxChunks.pop_front ();
+        return ret;
+    }
+    data = m_rxBuffers + (size_t)chunk.bid * RX_BUFFER_LEN + chunk.offset;
+    m_inPlace = true;
+    return chunk.res - chunk.offset;
+}
+
+void cUring::release (size_t len)
+{
+    if (m_inPlace && len)
+        consume (len);
+}
+
+ssize_t cUring::recvSingle (const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    std::memset (&msg, 0, sizeof (msg));
+    msg.msg_iov    = const_cast<struct iovec*>(iov);
+    msg.msg_iovlen = iovcnt;
+    return recvmsg (&msg);
+}
+
+ssize_t cUring::recvmsg (struct msghdr *msg)
+{
+    if (m_cancelled)
+        return -ECANCELED;
+    struct io_uring_sqe* sqe = getSqe (ID_IO);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd     = FILE_SOCKET;
+    sqe->flags  = IOSQE_FIXED_FILE;
+    sqe->addr   = (uint64_t)(uintptr_t)msg;
+    sqe->len    = 1;
+    return execute ();
+}
+
+ssize_t cUring::sendmsg (const struct msghdr *msg, int flags)
+{
+    if (m_cancelled)
+        return -ECANCELED;
+    struct io_uring_sqe* sqe = getSqe (ID_IO);
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = FILE_SOCKET;
+    sqe->flags     = IOSQE_FIXED_FILE;
+    sqe->addr      = (uint64_t)(uintptr_t)msg;
+    sqe->len       = 1;
+    sqe->msg_flags = (uint32_t)flags;
+    return execute ();
+}
+
+int cUring::accept (struct sockaddr *addr, socklen_t *addrlen)
+{
+    if (m_cancelled)
+        return -ECANCELED;
+    struct io_uring_sqe* sqe = getSqe (ID_IO);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd     = FILE_SOCKET;
+    sqe->flags  = IOSQE_FIXED_FILE;
+    sqe->addr   = (uint64_t)(uintptr_t)addr;
+    sqe->addr2  = (uint64_t)(uintptr_t)addrlen;
+    return execute ();
+}
+
+int cUring::connect (const struct sockaddr *addr, socklen_t addrlen)
+{
+    if (m_cancelled)
+        return -ECANCELED;
+    struct io_uring_sqe* sqe = getSqe (ID_IO);
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd     = FILE_SOCKET;
+    sqe->flags  = IOSQE_FIXED_FILE;
+    sqe->addr   = (uint64_t)(uintptr_t)addr;
+    sqe->off    = addrlen;
+    return execute ();
+}
+
+#else // HAVE_IO_URING
+
+cUring::~cUring ()
+{
+}
+
+cUring* cUring::create (int)
+{
+    return nullptr;
+}
+
+bool cUring::isSupported ()
+{
+    return false;
+}
+
+bool cUring::setCancelEvent (int)
+{
+    return false;
+}
+
+ssize_t cUring::recv (const struct iovec*, int)
+{
+    return -ENOSYS;
+}
+
+ssize_t cUring::recvInPlace (const uint8_t*&, void*, size_t)
+{
+    return -ENOSYS;
+}
+
+void cUring::release (size_t)
+{
+}
+
+ssize_t cUring::recvmsg (struct msghdr*)
+{
+    return -ENOSYS;
+}
+
+ssize_t cUring::sendmsg (const struct msghdr*, int)
+{
+    return -ENOSYS;
+}
+
+int cUring::accept (struct sockaddr*, socklen_t*)
+{
+    return -ENOSYS;
+}
+
+int cUring::connect (const struct sockaddr*, socklen_t)
+{
+    return -ENOSYS;
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <deque>
+
+struct io_uring_params;
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/**
+ * io_uring of one socket, used by cSocket instead of poll + syscall.
+ *
+ * The socket and the cancel event are registered as fixed files. A pending
+ * poll on the cancel event is part of every wait, so a termination request
+ * completes the wait without an extra syscall.
+ * Stream sockets receive with one multishot recv into a ring of provided
+ * buffers. As long as data is queued in the completion ring, receiving costs
+ * no syscall at all. recvInPlace hands out the buffers themselves, so the
+ * data is not copied either.
+ *
+ * All functions return the result of the kernel, i.e. a negative errno on
+ * error and -ECANCELED if the cancel event was signaled.
+ * Like the socket itself, a ring must only be used by one thread at a time.
+ */
+class cUring
+{
+public:
+    cUring (const cUring&) = delete;
+    cUring& operator=(const cUring&) = delete;
+    ~cUring ();
+
+    // returns nullptr if the kernel doesn't support io_uring
+    static cUring* create (int sockfd);
+    static bool isSupported ();
+
+    // returns false if the event could not be registered
+    bool setCancelEvent (int evfd);
+
+    bool isStream () const {return m_stream;}
+    // connected sockets only, returns 0 on end of stream
+    ssize_t recv (const struct iovec *iov, int iovcnt);
+    // like recv, but data points to the received octets within the buffer of
+    // the ring (or scratch, without multishot recv). They stay valid until
+    // release has been called for all of them.
+    ssize_t recvInPlace (const uint8_t*& data, void* scratch, size_t len);
+    void release (size_t len);
+    ssize_t recvmsg (struct msghdr *msg);
+    ssize_t sendmsg (const struct msghdr *msg, int flags);
+    int accept (struct sockaddr *addr, socklen_t *addrlen);
+    int connect (const struct sockaddr *addr, socklen_t addrlen);
+
+private:
+    cUring (int ringfd, bool stream);
+    bool init (int sockfd, const struct io_uring_params& p);
+    bool initBufRing ();
+    ssize_t recvSingle (const struct iovec *iov, int iovcnt);
+    int  waitChunk ();
+    void consume (size_t len);
+
+    struct io_uring_sqe* getSqe (uint64_t id);
+    void enter (unsigned minComplete);
+    void reap ();
+    int  execute ();
+    void armRecv ();
+    void armCancel ();
+    void cancel (uint64_t id);
+    bool isPending (uint64_t id) const;
+    void recycle (uint16_t bid);
+
+    enum : uint64_t
+    {
+        ID_IO = 1,      // the single shot operation currently executed
+        ID_RECV,        // multishot recv
+        ID_CANCEL,      // poll on the cancel event
+        ID_ASYNC_CANCEL
+    };
+    enum : unsigned
+    {
+        FILE_SOCKET = 0,  // fixed file indexes
+        FILE_CANCEL = 1
+    };
+
+    int  m_fd;
+    bool m_stream;
+
+    // submission and completion ring, shared with the kernel
+    void*     m_sqRing;
+    size_t    m_sqRingSize;
+    void*     m_cqRing;
+    size_t    m_cqRingSize;
+    struct io_uring_sqe* m_sqes;
+    size_t    m_sqesSize;
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned  m_sqMask;
+    unsigned  m_sqEntries;
+    unsigned* m_sqArray;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned  m_cqMask;
+    struct io_uring_cqe* m_cqes;
+    unsigned  m_toSubmit;
+
+    // state of the pending requests
+    bool m_ioDone;
+    int  m_ioResult;
+    bool m_recvArmed;
+    bool m_cancelArmed;
+    bool m_cancelled;
+    bool m_hasCancelEvent;
+
+    // registered buffer ring for multishot recv
+    enum : unsigned
+    {
+        RX_BUFFERS    = 16,
+        RX_BUFFER_LEN = 16 * 1024,
+        RX_GROUP      = 0
+    };
+    struct io_uring_buf_ring* m_bufRing;
+    size_t   m_bufRingSize;
+    uint8_t* m_rxBuffers;
+    bool     m_noMultishot;   // buffer ring or multishot recv not supported
+    struct cChunk
+    {
+        int      res;    // received octets, 0 on end of stream, -errno
+        uint16_t bid;
+        unsigned offset; // already consumed octets
+    };
+    std::deque<cChunk> m_rxChunks;
+    bool     m_inPlace;       // the front chunk has been handed out by recvInPlace
+};
+
+#endif
@@ -90,6 +90,31 @@ std::list<std::pair<unsigned long, unsigned long>> cValueParser::rangeList (cons
     return ret;
 }
 
+uint64_t cValueParser::bitRate (const std::string& s)
+{
+    std::smatch match;
+    if (!std::regex_match (s, match, std::regex (R"((\d+(\.\d+)?)([kMG]?))")))
+        throw std::invalid_argument (s);
+
+    double rate = std::stod (match[1].str ());
+    const std::string suffix = match[3].str ();
+    if (suffix == "k")
+        rate *= 1e3;
+    else if (suffix == "M")
+        rate *= 1e6;
+    else if (suffix == "G")
+        rate *= 1e9;
+    return (uint64_t)rate;
+}
+
+std::pair<uint64_t, uint64_t> cValueParser::rateLimit (const std::string& s)
+{
+    const auto colon = s.find (':');
+    if (colon == std::string::npos)
+        return std::make_pair (bitRate (s), (uint64_t)0);
+    return std::make_pair (bitRate (s.substr (0, colon)), bitRate (s.substr (colon + 1)));
+}
+
 bool cValueParser::isIPv4Address (const std::string& s)
 {
     uint8_t buf[sizeof(struct in6_addr)];
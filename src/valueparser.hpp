@@ -31,6 +31,10 @@ class cValueParser
 public:
     static std::pair<unsigned long, unsigned long> range (const std::string& s);
     static std::list<std::pair<unsigned long, unsigned long>> rangeList (const std::string& s);
+    // e.g. 100M -> 100000000, suffixes k, M and G are powers of 1000
+    static uint64_t bitRate (const std::string& s);
+    // "RATE[:BURST]", both with the suffixes of bitRate, e.g. 4G:64k. The burst is 0 if omitted.
+    static std::pair<uint64_t, uint64_t> rateLimit (const std::string& s);
     static bool isIPv4Address (const std::string& s);
     static bool isIPv6Address (const std::string& s);
     static void clientConnection (const std::string& s, cSocket::Properties& proto, std::string& remoteHost,
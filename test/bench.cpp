@@ -0,0 +1,333 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the hot paths, each compared with the implementation it
+ * replaced. Usage: bench [name...], without names all benchmarks are run.
+ * The numbers depend on the CPU, run them on an otherwise idle host.
+ */
+
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "event.hpp"
+#include "payload.hpp"
+#include "socket.hpp"
+#include "stats.hpp"
+
+
+typedef std::chrono::steady_clock benchClock;
+
+static double elapsedNs (benchClock::time_point start)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(benchClock::now () - start).count ();
+}
+
+static uint64_t cycles ()
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc ();
+#else
+    return 0;
+#endif
+}
+
+// keeps the compiler from dropping results
+static volatile uint64_t sink;
+
+
+/*
+ * payload: cPayload::fill/check against the byte loops they replaced
+ * (cBabblerProtocol::sendMessage and checkPayload before the vectorization).
+ */
+
+__attribute__((noinline))
+static void referenceFill (uint8_t* p, size_t len, uint8_t& counter, bool incr)
+{
+    while (len--)
+        *p++ = incr ? ++counter : --counter;
+}
+
+__attribute__((noinline))
+static size_t referenceCheck (const uint8_t* data, size_t len, uint8_t& expVal, bool incr)
+{
+    for (size_t n = 0; n < len; n++)
+    {
+        incr ? ++expVal : --expVal;
+        if (*data++ != expVal)
+            return n;
+    }
+    return len;
+}
+
+static void runPayload (const char* name, cPayload::fill_t fill, cPayload::check_t check)
+{
+    const size_t   len = 65536;
+    const unsigned rounds = 2000;
+    std::vector<uint8_t> buf (len);
+
+    uint8_t counter = 0;
+    fill (buf.data (), len, counter, true); // warm up
+
+    uint64_t c = cycles ();
+    auto t = benchClock::now ();
+    for (unsigned n = 0; n < rounds; n++)
+        fill (buf.data (), len, counter, true);
+    uint64_t fillCycles = cycles () - c;
+    double fillNs = elapsedNs (t);
+
+    uint64_t errors = 0;
+    c = cycles ();
+    t = benchClock::now ();
+    for (unsigned n = 0; n < rounds; n++)
+    {
+        uint8_t expVal = (uint8_t)(counter - len);
+        errors += check (buf.data (), len, expVal, true) != len;
+    }
+    uint64_t checkCycles = cycles () - c;
+    double checkNs = elapsedNs (t);
+    sink = errors;
+
+    const double bytes = (double)len * rounds;
+    std::printf ("  %-10s fill  %6.2f bytes/ns", name, bytes / fillNs);
+    if (fillCycles)
+        std::printf (", %6.2f bytes/cycle", bytes / fillCycles);
+    std::printf ("\n  %-10s check %6.2f bytes/ns", name, bytes / checkNs);
+    if (checkCycles)
+        std::printf (", %6.2f bytes/cycle", bytes / checkCycles);
+    std::printf ("%s\n", errors ? " (MISMATCH)" : "");
+}
+
+static void benchPayload ()
+{
+    std::printf ("payload, 64 KiB buffer\n");
+    runPayload ("byte loop", referenceFill, referenceCheck);
+    runPayload (cPayload::implementation (), cPayload::fill, cPayload::check);
+}
+
+
+/*
+ * stats: one counter update of cSharedStats (seqlock) against a cStats
+ * protected by a mutex, as cBabblerProtocol had it before. A second thread
+ * reads the statistics of all connections every millisecond, like the status
+ * output does.
+ */
+
+class cLockedStats
+{
+public:
+    cStats& beginUpdate ()
+    {
+        m_lock.lock ();
+        return m_stats;
+    }
+    void endUpdate ()
+    {
+        m_lock.unlock ();
+    }
+    void read (cStats& stats) const
+    {
+        std::lock_guard<std::mutex> lock (m_lock);
+        stats = m_stats;
+    }
+
+private:
+    mutable std::mutex m_lock;
+    cStats m_stats;
+};
+
+static void update (cLockedStats& stats)
+{
+    cStats& s = stats.beginUpdate ();
+    s.m_sentOctets += 32;
+    s.m_sentPackets++;
+    stats.endUpdate ();
+}
+
+static void update (cSharedStats& stats)
+{
+    stats.beginUpdate ();
+    stats.m_sentOctets  += 32;
+    stats.m_sentPackets += 1;
+    stats.endUpdate ();
+}
+
+template <typename T>
+static double runStats (size_t connections)
+{
+    const unsigned updates = 20000000;
+    std::vector<T> stats (connections);
+    std::atomic<bool> stop (false);
+
+    std::thread reader ([&stats, &stop]()
+    {
+        cStats snapshot;
+        int_fast64_t sum = 0;
+        while (!stop.load (std::memory_order_relaxed))
+        {
+            for (const auto& s : stats)
+            {
+                s.read (snapshot);
+                sum += snapshot.m_sentOctets;
+            }
+            std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        }
+        sink = (uint64_t)sum;
+    });
+
+    auto t = benchClock::now ();
+    for (unsigned n = 0; n < updates; n++)
+        update (stats[n % connections]);
+    double ns = elapsedNs (t);
+
+    stop = true;
+    reader.join ();
+    return ns / updates;
+}
+
+static void benchStats ()
+{
+    std::printf ("stats, ns per update\n");
+    for (size_t connections : {1, 64, 1024})
+    {
+        double locked = runStats<cLockedStats> (connections);
+        double shared = runStats<cSharedStats> (connections);
+        std::printf ("  %4zu connections: mutex %5.1f, seqlock %5.1f\n", connections, locked, shared);
+    }
+}
+
+
+/*
+ * recv: receive of 32-byte messages which are already queued, cSocket::recvv
+ * (tries recvmsg first) against poll on socket and cancel event followed by
+ * recvmsg, as every receive did before.
+ *
+ * The end-to-end numbers are replies per second of nb on loopback, this
+ * commit against its parent, e.g.:
+ *   nb -l 5001
+ *   nb -t 4 -w 1  --proto-settings 32,32,32,32 tcp://127.0.0.1:5001
+ *   nb -t 4 -w 16 --proto-settings 32,32,32,32 udp://127.0.0.1:5001
+ */
+
+static double runRecv (bool reference)
+{
+    const unsigned batch = 256, rounds = 4000;
+    const size_t   msgSize = 32;
+
+    auto sockets = cSocket::pair (SOCK_STREAM);
+    cEvent cancel;
+    sockets.second.setCancelEvent (cancel);
+    std::vector<uint8_t> tx (batch * msgSize);
+    uint8_t rx[msgSize];
+    struct iovec iov = {rx, sizeof (rx)};
+    struct pollfd fds[2] = {{sockets.second.nativeHandle (), POLLIN, 0}, {cancel, POLLIN, 0}};
+
+    double ns = 0;
+    for (unsigned r = 0; r < rounds; r++)
+    {
+        if (sockets.first.send (tx.data (), tx.size ()) != (ssize_t)tx.size ())
+            throw cSocket::errorException ("short send");
+
+        auto t = benchClock::now ();
+        for (unsigned n = 0; n < batch; n++)
+        {
+            ssize_t len;
+            if (reference)
+            {
+                if (poll (fds, 2, -1) < 0)
+                    throw cSocket::errorException (errno);
+                struct msghdr msg;
+                std::memset (&msg, 0, sizeof (msg));
+                msg.msg_iov    = &iov;
+                msg.msg_iovlen = 1;
+                len = ::recvmsg (sockets.second.nativeHandle (), &msg, MSG_DONTWAIT);
+            }
+            else
+            {
+                len = sockets.second.recvv (&iov, 1);
+            }
+            if (len != (ssize_t)msgSize)
+                throw cSocket::errorException ("short receive");
+        }
+        ns += elapsedNs (t);
+    }
+    return ns / (batch * rounds);
+}
+
+static void benchRecv ()
+{
+    std::printf ("recv, 32-byte messages already queued, ns per receive\n");
+    double reference = runRecv (true);
+    double current   = runRecv (false);
+    std::printf ("  poll + recvmsg %6.1f\n  recvv          %6.1f\n", reference, current);
+}
+
+
+struct cBenchmark
+{
+    const char* name;
+    void (*run) ();
+};
+
+static const cBenchmark BENCHMARKS[] =
+{
+    {"payload", benchPayload},
+    {"stats",   benchStats},
+    {"recv",    benchRecv},
+};
+
+int main (int argc, char* argv[])
+{
+    int ret = 0;
+    for (const auto& b : BENCHMARKS)
+    {
+        bool selected = argc < 2;
+        for (int n = 1; n < argc; n++)
+            selected |= !std::strcmp (argv[n], b.name);
+        if (selected)
+            b.run ();
+    }
+    for (int n = 1; n < argc; n++)
+    {
+        bool known = false;
+        for (const auto& b : BENCHMARKS)
+            known |= !std::strcmp (argv[n], b.name);
+        if (!known)
+        {
+            std::fprintf (stderr, "unknown benchmark '%s'\n", argv[n]);
+            ret = 1;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,294 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * NET-BABBLER <https://github.com/amartin755/net-babbler>
+ * Copyright (C) 2023 Andreas Martin (netnag@mailbox.org)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Receive path of cBabblerProtocol with arbitrary chunking.
+ *
+ * A stream of requests is recorded once and then fed to a receiving protocol
+ * over a socketpair, split at every byte offset, in single bytes and in random
+ * chunks, with receive buffers down to one byte. Each chunk is completely
+ * consumed before the next one is written, so every receive call ends exactly
+ * at the split. Covered are plain messages, the CRC32C trailer, header
+ * timestamps, both together and random payload, as well as the detection of
+ * a corrupted message.
+ */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "protocol.hpp"
+
+
+class cTestProtocol : public cBabblerProtocol
+{
+public:
+    cTestProtocol (cSocket& sock, unsigned bufsize, const cProtocolOptions& options)
+        : cBabblerProtocol (sock, bufsize, options)
+    {
+    }
+    using cBabblerProtocol::getRxHeaderTimestamps;
+};
+
+struct cMessage
+{
+    uint64_t seq;
+    unsigned reqSize;
+    unsigned respSize;
+};
+
+// header only, too small for the trailer, room for the trailer only, for the timestamps only,
+// for both, larger ones
+static const cMessage MESSAGES[] =
+{
+    {1,   24,   32},
+    {2,   26,   27},
+    {3,   28,   24},
+    {4,   48,   64},
+    {5,   52,    0},
+    {6,  300, 1400},
+    {7, 1500,   32},
+    {8,   33,   33},
+};
+static const size_t MESSAGE_COUNT = sizeof (MESSAGES) / sizeof (MESSAGES[0]);
+
+struct cReceived
+{
+    uint64_t seq;
+    uint32_t respSize;
+    bool     hasTimestamps;
+    uint64_t clientSend;
+};
+
+static unsigned failures = 0;
+
+static void fail (const std::string& what)
+{
+    std::printf ("FAIL: %s\n", what.c_str ());
+    failures++;
+}
+
+// the byte stream of all MESSAGES, as sent by the protocol
+static std::vector<uint8_t> record (const cProtocolOptions& options)
+{
+    auto sockets = cSocket::pair (SOCK_STREAM);
+    {
+        cTestProtocol tx (sockets.first, 65536, options);
+        for (const auto& msg : MESSAGES)
+            tx.sendRequest (msg.seq, msg.reqSize, msg.respSize);
+    }
+
+    std::vector<uint8_t> stream;
+    uint8_t buf[4096];
+    ssize_t len;
+    while ((len = ::recv (sockets.second.nativeHandle (), buf, sizeof (buf), MSG_DONTWAIT)) > 0)
+        stream.insert (stream.end (), buf, buf + len);
+    return stream;
+}
+
+/*
+ * Writes the stream in chunks (lengths of the chunks) and receives everything
+ * after each chunk. Throws cProtocolException on invalid messages.
+ */
+static std::vector<cReceived> feed (const std::vector<uint8_t>& stream, const std::vector<size_t>& chunks,
+    unsigned bufsize, const cProtocolOptions& options)
+{
+    auto sockets = cSocket::pair (SOCK_STREAM);
+    sockets.second.setNonBlocking ();
+    cTestProtocol rx (sockets.second, bufsize, options);
+
+    std::vector<cReceived> received;
+    size_t offset = 0;
+    for (auto len : chunks)
+    {
+        if (::send (sockets.first.nativeHandle (), stream.data () + offset, len, 0) != (ssize_t)len)
+            throw cSocket::errorException (errno);
+        offset += len;
+
+        for (;;)
+        {
+            cReceived r;
+            if (rx.tryRecvRequest (r.seq, r.respSize))
+            {
+                const cProtocolTimestamps* ts = rx.getRxHeaderTimestamps ();
+                r.hasTimestamps = ts != nullptr;
+                r.clientSend    = ts ? ts->getClientSend () : 0;
+                received.push_back (r);
+                continue;
+            }
+            int pending = 0;
+            if (ioctl (sockets.second.nativeHandle (), FIONREAD, &pending) || !pending)
+                break;
+        }
+    }
+
+    cStats stats;
+    rx.getStats (stats);
+    if (stats.m_verifiedPackets != (int_fast64_t)received.size ())
+        throw cProtocolException ("verified " + std::to_string (stats.m_verifiedPackets) + " of " +
+            std::to_string (received.size ()) + " messages");
+    return received;
+}
+
+// compares with the reception of the unsplit stream
+static void check (const std::string& name, const std::vector<uint8_t>& stream, const std::vector<size_t>& chunks,
+    unsigned bufsize, const cProtocolOptions& options, const std::vector<cReceived>& expected)
+{
+    std::vector<cReceived> received;
+    try
+    {
+        received = feed (stream, chunks, bufsize, options);
+    }
+    catch (const std::exception& e)
+    {
+        fail (name + ": " + e.what ());
+        return;
+    }
+
+    if (received.size () != expected.size ())
+    {
+        fail (name + ": received " + std::to_string (received.size ()) + " of " +
+            std::to_string (expected.size ()) + " messages");
+        return;
+    }
+    for (size_t n = 0; n < received.size (); n++)
+    {
+        const cReceived& r = received[n];
+        const cReceived& e = expected[n];
+        if (r.seq != e.seq || r.respSize != e.respSize || r.hasTimestamps != e.hasTimestamps ||
+            r.clientSend != e.clientSend)
+        {
+            fail (name + ": message " + std::to_string (n) + " differs");
+            return;
+        }
+    }
+}
+
+static void testSplits (const char* variant, const cProtocolOptions& options)
+{
+    const std::vector<uint8_t> stream = record (options);
+    const size_t total = stream.size ();
+
+    // reference: everything at once
+    std::vector<cReceived> expected;
+    try
+    {
+        expected = feed (stream, {total}, 65536, options);
+    }
+    catch (const std::exception& e)
+    {
+        fail (std::string (variant) + ": unsplit stream: " + e.what ());
+        return;
+    }
+    if (expected.size () != MESSAGE_COUNT)
+    {
+        fail (std::string (variant) + ": unsplit stream: " + std::to_string (expected.size ()) + " messages");
+        return;
+    }
+    for (size_t n = 0; n < MESSAGE_COUNT; n++)
+    {
+        const cMessage& msg = MESSAGES[n];
+        const unsigned payload  = msg.reqSize - sizeof (cProtocolHeader);
+        const unsigned respSize = msg.respSize ? msg.respSize - sizeof (cProtocolHeader) : 0;
+        const bool crc = options.useCrc32c () && payload >= sizeof (uint32_t);
+        const bool ts  = options.m_headerTimestamps &&
+            payload >= sizeof (cProtocolTimestamps) + (crc ? sizeof (uint32_t) : 0);
+        if (expected[n].seq != msg.seq || expected[n].respSize != respSize ||
+            expected[n].hasTimestamps != ts || (ts && !expected[n].clientSend))
+            fail (std::string (variant) + ": unsplit stream: message " + std::to_string (n) + " differs");
+    }
+
+    for (unsigned bufsize : {65536u, 7u, 1u})
+    {
+        const std::string prefix = std::string (variant) + ", buffer " + std::to_string (bufsize);
+
+        // two chunks, split at every offset
+        for (size_t split = 1; split < total; split++)
+            check (prefix + ", split at " + std::to_string (split), stream, {split, total - split},
+                bufsize, options, expected);
+
+        // single bytes
+        check (prefix + ", single bytes", stream, std::vector<size_t> (total, 1), bufsize, options, expected);
+
+        // random chunks, reproducible
+        std::mt19937 rng (bufsize);
+        for (unsigned run = 0; run < 100; run++)
+        {
+            std::vector<size_t> chunks;
+            for (size_t rest = total; rest; )
+            {
+                size_t len = std::min (rest, (size_t)std::uniform_int_distribution<unsigned> (1, 100) (rng));
+                chunks.push_back (len);
+                rest -= len;
+            }
+            check (prefix + ", random chunks " + std::to_string (run), stream, chunks, bufsize, options, expected);
+        }
+    }
+
+    // a corrupted payload byte of the last message must be detected with any chunking
+    std::vector<uint8_t> corrupted = stream;
+    corrupted[total - 5] ^= 0x01;
+    for (unsigned bufsize : {65536u, 1u})
+    {
+        try
+        {
+            feed (corrupted, std::vector<size_t> (total, 1), bufsize, options);
+            fail (std::string (variant) + ": corrupted payload not detected");
+        }
+        catch (const cProtocolException&)
+        {
+        }
+    }
+}
+
+int main ()
+{
+    cProtocolOptions plain;
+
+    cProtocolOptions crc;
+    crc.m_crc32c = true;
+
+    cProtocolOptions timestamps;
+    timestamps.m_headerTimestamps = true;
+
+    cProtocolOptions both;
+    both.m_crc32c = true;
+    both.m_headerTimestamps = true;
+
+    cProtocolOptions random;
+    random.m_payload = cPayloadCache::RANDOM;
+
+    testSplits ("plain", plain);
+    testSplits ("crc32c", crc);
+    testSplits ("timestamps", timestamps);
+    testSplits ("crc32c + timestamps", both);
+    testSplits ("random payload", random);
+
+    if (failures)
+    {
+        std::printf ("%u failures\n", failures);
+        return 1;
+    }
+    std::printf ("all passed\n");
+    return 0;
+}